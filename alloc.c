@@ -0,0 +1,304 @@
+/*
+ * alloc.c - Allocation tracking
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Call sites are static structures created by the allocation macros. They are
+ * registered on their first allocation, by pushing them onto a lock-free list,
+ * and their counters are atomic, so recording an allocation takes no lock.
+ *
+ * To attribute a free to its call site, we keep a map from each live pointer
+ * to its site and size. The map is split into stripes, each with its own lock,
+ * so that threads rarely contend.
+ *
+ * This file must not use the tracking macros itself.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+#include "thread.h"
+
+#undef free
+
+
+#define	STRIPE_BITS	6
+#define	STRIPES		(1 << STRIPE_BITS)
+#define	MIN_ENTRIES	64
+
+
+struct entry {
+	const void		*p;	/* NULL if the entry is unused */
+	struct alloc_site	*site;
+	size_t			size;
+};
+
+struct stripe {
+	pthread_mutex_t		mutex;
+	struct entry		*e;
+	size_t			size;	/* power of two, or zero */
+	size_t			n;
+} __attribute__((aligned(64)));
+
+
+static _Atomic(struct alloc_site *) sites = NULL;
+static struct stripe stripes[STRIPES] = {
+	[0 ... STRIPES - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER },
+};
+
+
+/* ----- Pointer map ------------------------------------------------------- */
+
+
+static uint64_t hash(const void *p)
+{
+	return ((uintptr_t) p >> 4) * 0x9e3779b97f4a7c15ull;
+}
+
+
+static struct stripe *stripe_of(uint64_t h)
+{
+	return stripes + (h >> (64 - STRIPE_BITS));
+}
+
+
+/* called with the stripe locked */
+
+static void map_insert(struct stripe *s, uint64_t h, const struct entry *e);
+
+static void map_grow(struct stripe *s)
+{
+	struct entry *old = s->e;
+	size_t old_size = s->size;
+	size_t i;
+
+	s->size = old_size ? 2 * old_size : MIN_ENTRIES;
+	s->e = calloc(s->size, sizeof(struct entry));
+	if (!s->e) {
+		perror("calloc");
+		exit(1);
+	}
+	s->n = 0;
+	for (i = 0; i != old_size; i++)
+		if (old[i].p)
+			map_insert(s, hash(old[i].p), old + i);
+	free(old);
+}
+
+
+static void map_insert(struct stripe *s, uint64_t h, const struct entry *e)
+{
+	size_t i;
+
+	if (2 * (s->n + 1) > s->size)
+		map_grow(s);
+	for (i = h & (s->size - 1); s->e[i].p; i = (i + 1) & (s->size - 1));
+	s->e[i] = *e;
+	s->n++;
+}
+
+
+/* find and remove; returns false if "p" is not in the map */
+
+static bool map_remove(struct stripe *s, uint64_t h, const void *p,
+    struct entry *res)
+{
+	size_t mask = s->size - 1;
+	size_t i, j;
+
+	if (!s->size)
+		return 0;
+	for (i = h & mask; s->e[i].p != p; i = (i + 1) & mask)
+		if (!s->e[i].p)
+			return 0;
+	*res = s->e[i];
+	s->n--;
+
+	/* backward-shift deletion, so that no tombstones are needed */
+	for (j = (i + 1) & mask; s->e[j].p; j = (j + 1) & mask) {
+		size_t home = hash(s->e[j].p) & mask;
+
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			s->e[i] = s->e[j];
+			i = j;
+		}
+	}
+	s->e[i].p = NULL;
+	return 1;
+}
+
+
+/* ----- Accounting -------------------------------------------------------- */
+
+
+static void account(struct alloc_site *site, int64_t n, int64_t bytes)
+{
+	int64_t live, peak;
+
+	atomic_fetch_add_explicit(&site->live, n, memory_order_relaxed);
+	live = atomic_fetch_add_explicit(&site->live_bytes, bytes,
+	    memory_order_relaxed) + bytes;
+	if (bytes <= 0)
+		return;
+	peak = atomic_load_explicit(&site->peak_bytes, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(
+	    &site->peak_bytes, &peak, live,
+	    memory_order_relaxed, memory_order_relaxed));
+}
+
+
+void alloc_track(struct alloc_site *site, void *p, size_t size)
+{
+	uint64_t h = hash(p);
+	struct stripe *s = stripe_of(h);
+	struct entry e = {
+		.p	= p,
+		.site	= site,
+		.size	= size,
+	};
+	struct entry stale;
+	bool found;
+
+	if (!atomic_flag_test_and_set(&site->registered)) {
+		site->next = atomic_load(&sites);
+		while (!atomic_compare_exchange_weak(&sites, &site->next,
+		    site));
+	}
+	atomic_fetch_add_explicit(&site->allocs, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->bytes, size, memory_order_relaxed);
+	account(site, 1, size);
+
+	lock(&s->mutex);
+	/* freed without tracking, and the address has now been reused */
+	found = map_remove(s, h, p, &stale);
+	map_insert(s, h, &e);
+	unlock(&s->mutex);
+	if (found)
+		account(stale.site, -1, -(int64_t) stale.size);
+}
+
+
+void alloc_untrack(const void *p)
+{
+	uint64_t h = hash(p);
+	struct stripe *s = stripe_of(h);
+	struct entry e;
+	bool found;
+
+	if (!p)
+		return;
+	lock(&s->mutex);
+	found = map_remove(s, h, p, &e);
+	unlock(&s->mutex);
+	if (found)
+		account(e.site, -1, -(int64_t) e.size);
+}
+
+
+void alloc_free(void *p)
+{
+	alloc_untrack(p);
+	free(p);
+}
+
+
+/* ----- Reporting --------------------------------------------------------- */
+
+
+struct report {
+	const char	*file;
+	unsigned	line;
+	uint64_t	allocs;
+	uint64_t	bytes;
+	int64_t		live;
+	int64_t		live_bytes;
+	int64_t		peak_bytes;
+};
+
+
+static int by_site(const void *a, const void *b)
+{
+	const struct report *ra = a;
+	const struct report *rb = b;
+	int res = strcmp(ra->file, rb->file);
+
+	return res ? res : (int) ra->line - (int) rb->line;
+}
+
+
+static int by_live_bytes(const void *a, const void *b)
+{
+	const struct report *ra = a;
+	const struct report *rb = b;
+
+	return ra->live_bytes < rb->live_bytes ? 1 :
+	    ra->live_bytes > rb->live_bytes ? -1 : 0;
+}
+
+
+void alloc_track_dump(FILE *file)
+{
+	struct alloc_site *site;
+	struct report *r = NULL;
+	unsigned n = 0, size = 0;
+	unsigned i, j;
+
+	for (site = atomic_load(&sites); site; site = site->next) {
+		if (n == size) {
+			size = size ? 2 * size : 64;
+			r = realloc(r, size * sizeof(*r));
+			if (!r) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		r[n].file = site->file;
+		r[n].line = site->line;
+		r[n].allocs = atomic_load(&site->allocs);
+		r[n].bytes = atomic_load(&site->bytes);
+		r[n].live = atomic_load(&site->live);
+		r[n].live_bytes = atomic_load(&site->live_bytes);
+		r[n].peak_bytes = atomic_load(&site->peak_bytes);
+		n++;
+	}
+
+	/* inline functions in headers have one site per file using them */
+	qsort(r, n, sizeof(*r), by_site);
+	for (i = j = 0; i != n; i++) {
+		if (j && !by_site(r + i, r + j - 1)) {
+			r[j - 1].allocs += r[i].allocs;
+			r[j - 1].bytes += r[i].bytes;
+			r[j - 1].live += r[i].live;
+			r[j - 1].live_bytes += r[i].live_bytes;
+			/* the sites may not have peaked at the same time */
+			if (r[i].peak_bytes > r[j - 1].peak_bytes)
+				r[j - 1].peak_bytes = r[i].peak_bytes;
+		} else {
+			r[j++] = r[i];
+		}
+	}
+	n = j;
+	qsort(r, n, sizeof(*r), by_live_bytes);
+
+	fprintf(file, "%12s %8s %12s %10s %12s  %s\n",
+	    "LIVE_BYTES", "LIVE", "PEAK_BYTES", "ALLOCS", "BYTES", "SITE");
+	for (i = 0; i != n; i++)
+		fprintf(file, "%12lld %8lld %12lld %10llu %12llu  %s:%u\n",
+		    (long long) r[i].live_bytes, (long long) r[i].live,
+		    (long long) r[i].peak_bytes,
+		    (unsigned long long) r[i].allocs,
+		    (unsigned long long) r[i].bytes, r[i].file, r[i].line);
+	free(r);
+}
@@ -14,15 +14,72 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 
 
+/*
+ * Allocation tracking: if LINZHI_ALLOC_TRACK is defined, the macros below
+ * record, per call site, the number of allocations, the bytes allocated, and
+ * the live and peak bytes. free() is redirected to alloc_free, which also
+ * accepts memory not allocated through these macros. Memory that is allocated
+ * in a tracked and freed in an untracked file remains counted as live.
+ *
+ * alloc_track_dump lists all call sites seen so far, largest live bytes
+ * first. If a site appears in several files, e.g., in an inline function, its
+ * entries are merged, and the peak shown is the largest of their peaks.
+ */
+
+struct alloc_site {
+	const char			*file;
+	unsigned			line;
+	atomic_flag			registered;
+	struct alloc_site		*next;
+	atomic_uint_least64_t		allocs;
+	atomic_uint_least64_t		bytes;
+	atomic_int_least64_t		live;
+	atomic_int_least64_t		live_bytes;
+	atomic_int_least64_t		peak_bytes;
+};
+
+
+void alloc_track(struct alloc_site *site, void *p, size_t size);
+void alloc_untrack(const void *p);
+void alloc_free(void *p);
+void alloc_track_dump(FILE *file);
+
+
+#ifdef LINZHI_ALLOC_TRACK
+
+#define	alloc_site_here()					\
+    ({	static struct alloc_site alloc_site_tmp = {		\
+		.file		= __FILE__,			\
+		.line		= __LINE__,			\
+		.registered	= ATOMIC_FLAG_INIT,		\
+	};							\
+	&alloc_site_tmp; })
+
+#define	alloc_track_here(p, s) alloc_track(alloc_site_here(), (p), (s))
+#define	alloc_untrack_here(p) alloc_untrack(p)
+
+#define	free(p) alloc_free(p)
+
+#else /* LINZHI_ALLOC_TRACK */
+
+#define	alloc_track_here(p, s) ((void) (p), (void) (s))
+#define	alloc_untrack_here(p) ((void) (p))
+
+#endif /* !LINZHI_ALLOC_TRACK */
+
+
 #define alloc_size(s)					\
-    ({	void *alloc_size_tmp = malloc(s);		\
+    ({	size_t alloc_size_n = (s);			\
+	void *alloc_size_tmp = malloc(alloc_size_n);	\
 	if (!alloc_size_tmp) {				\
 		perror("malloc");			\
 		exit(1);				\
 	}						\
+	alloc_track_here(alloc_size_tmp, alloc_size_n);	\
 	alloc_size_tmp; })
 
 #define alloc_type(t) ((t *) alloc_size(sizeof(t)))
@@ -30,11 +87,19 @@
 
 
 #define realloc_size(p, s)				\
-    ({ void *alloc_size_tmp = realloc((p), (s));	\
+    ({	void *realloc_size_p = (p);			\
+	size_t realloc_size_n = (s);			\
+	void *alloc_size_tmp;				\
+							\
+	alloc_untrack_here(realloc_size_p);		\
+	alloc_size_tmp =				\
+	    realloc(realloc_size_p, realloc_size_n);	\
 	if (!alloc_size_tmp) {				\
 		perror("realloc");			\
 		exit(1);				\
 	}						\
+	alloc_track_here(alloc_size_tmp,		\
+	    realloc_size_n);				\
 	alloc_size_tmp; })
 
 #define realloc_type_n(p, n) \
@@ -47,6 +112,8 @@
 		perror("strdup");			\
 		exit(1);				\
 	}						\
+	alloc_track_here(stralloc_tmp,			\
+	    strlen(stralloc_tmp) + 1);			\
 	stralloc_tmp; })
 
 #define strnalloc(s, n)					\
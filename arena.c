@@ -0,0 +1,208 @@
+/*
+ * arena.c - Region allocator
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "arena.h"
+
+
+#define	ALIGN	_Alignof(max_align_t)
+
+
+struct arena_block {
+	struct arena_block	*next;
+	size_t			size;
+	size_t			used;
+	max_align_t		data[];
+};
+
+
+static size_t align(size_t size)
+{
+	return (size + ALIGN - 1) & ~(ALIGN - 1);
+}
+
+
+void arena_init(struct arena *a, size_t block_size)
+{
+	a->blocks = a->spare = NULL;
+	/* keep "used" aligned, even when a block is filled to the end */
+	a->block_size = align(block_size ? block_size : ARENA_DEFAULT_BLOCK);
+}
+
+
+static void free_list(struct arena_block *b)
+{
+	struct arena_block *next;
+
+	while (b) {
+		next = b->next;
+		free(b);
+		b = next;
+	}
+}
+
+
+void arena_free(struct arena *a)
+{
+	free_list(a->blocks);
+	free_list(a->spare);
+	a->blocks = a->spare = NULL;
+}
+
+
+/* ----- Allocation -------------------------------------------------------- */
+
+
+static struct arena_block *new_block(struct arena *a, size_t size)
+{
+	struct arena_block **anchor, *b;
+	bool own = size > a->block_size;
+
+	/* large allocations get a block of their own */
+	if (!own)
+		size = a->block_size;
+	for (anchor = &a->spare; *anchor; anchor = &(*anchor)->next)
+		if ((*anchor)->size >= size)
+			break;
+	b = *anchor;
+	if (b) {
+		*anchor = b->next;
+	} else {
+		b = alloc_size(sizeof(struct arena_block) + size);
+		b->size = size;
+	}
+	b->used = 0;
+	/* a block of its own is full, so keep using the current block */
+	anchor = own && a->blocks ? &a->blocks->next : &a->blocks;
+	b->next = *anchor;
+	*anchor = b;
+	return b;
+}
+
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_block *b = a->blocks;
+	void *p;
+
+	size = align(size ? size : 1);
+	if (!b || b->size - b->used < size)
+		b = new_block(a, size);
+	p = (char *) b->data + b->used;
+	b->used += size;
+	return p;
+}
+
+
+char *arena_strndup(struct arena *a, const char *s, size_t n)
+{
+	char *p = arena_alloc(a, n + 1);
+
+	memcpy(p, s, n);
+	p[n] = 0;
+	return p;
+}
+
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+	return arena_strndup(a, s, strlen(s));
+}
+
+
+char *arena_vprintf(struct arena *a, const char *fmt, va_list ap)
+{
+	struct arena_block *b = a->blocks;
+	size_t avail = b ? b->size - b->used : 0;
+	va_list aq;
+	char *p;
+	int len;
+
+	/* try to format directly into the rest of the current block */
+	va_copy(aq, ap);
+	p = b ? (char *) b->data + b->used : NULL;
+	len = vsnprintf(p, avail, fmt, aq);
+	va_end(aq);
+	if (len < 0) {
+		perror("vsnprintf");
+		exit(1);
+	}
+	if (align(len + 1) <= avail) {
+		b->used += align(len + 1);
+		return p;
+	}
+	p = arena_alloc(a, len + 1);
+	vsnprintf(p, len + 1, fmt, ap);
+	return p;
+}
+
+
+char *arena_printf(struct arena *a, const char *fmt, ...)
+{
+	va_list ap;
+	char *p;
+
+	va_start(ap, fmt);
+	p = arena_vprintf(a, fmt, ap);
+	va_end(ap);
+	return p;
+}
+
+
+/* ----- Releasing --------------------------------------------------------- */
+
+
+struct arena_mark arena_mark(const struct arena *a)
+{
+	struct arena_mark mark = {
+		.block	= a->blocks,
+		.used	= a->blocks ? a->blocks->used : 0,
+		.next	= a->blocks ? a->blocks->next : NULL,
+	};
+
+	return mark;
+}
+
+
+static void release(struct arena *a, struct arena_block **anchor)
+{
+	struct arena_block *b = *anchor;
+
+	*anchor = b->next;
+	b->next = a->spare;
+	a->spare = b;
+}
+
+
+void arena_rewind(struct arena *a, struct arena_mark mark)
+{
+	while (a->blocks != mark.block)
+		release(a, &a->blocks);
+	if (!mark.block)
+		return;
+	/* large blocks linked behind the marked block since */
+	while (mark.block->next != mark.next)
+		release(a, &mark.block->next);
+	mark.block->used = mark.used;
+}
+
+
+void arena_reset(struct arena *a)
+{
+	struct arena_mark mark = { NULL, 0, NULL };
+
+	arena_rewind(a, mark);
+}
@@ -0,0 +1,65 @@
+/*
+ * arena.h - Region allocator
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Objects are allocated by advancing a pointer in a block, and are never
+ * freed individually. Instead, arena_rewind releases everything allocated
+ * after a mark, and arena_reset everything. Blocks are kept for reuse until
+ * arena_free. Like the functions in alloc.h, running out of memory is fatal.
+ *
+ * An arena is not thread-safe.
+ */
+
+#ifndef LINZHI_LIBCOMMON_ARENA_H
+#define	LINZHI_LIBCOMMON_ARENA_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+
+#define	ARENA_DEFAULT_BLOCK	4096
+
+
+struct arena_block;
+
+struct arena {
+	struct arena_block	*blocks;	/* current block first */
+	struct arena_block	*spare;
+	size_t			block_size;
+};
+
+struct arena_mark {
+	struct arena_block	*block;
+	size_t			used;
+	struct arena_block	*next;	/* the block after "block" */
+};
+
+
+/* block_size 0 selects ARENA_DEFAULT_BLOCK */
+
+void arena_init(struct arena *a, size_t block_size);
+void arena_free(struct arena *a);
+
+void *arena_alloc(struct arena *a, size_t size);
+
+#define	arena_alloc_type(a, t) ((t *) arena_alloc((a), sizeof(t)))
+#define	arena_alloc_type_n(a, t, n) \
+    ((t *) arena_alloc((a), sizeof(t) * (n)))
+
+char *arena_strdup(struct arena *a, const char *s);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+char *arena_vprintf(struct arena *a, const char *fmt, va_list ap);
+char *arena_printf(struct arena *a, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+struct arena_mark arena_mark(const struct arena *a);
+void arena_rewind(struct arena *a, struct arena_mark mark);
+void arena_reset(struct arena *a);
+
+#endif /* !LINZHI_LIBCOMMON_ARENA_H */
@@ -0,0 +1,288 @@
+/*
+ * bench/bench.c - Microbenchmark harness
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "thread.h"
+
+#include "bench.h"
+
+
+enum bench_format {
+	bench_text,
+	bench_csv,
+	bench_json,
+};
+
+struct run {
+	void		(*fn)(void *user, unsigned thread, uint64_t n);
+	void		*user;
+	uint64_t	n;
+	unsigned	rounds;
+	pthread_barrier_t start;
+	pthread_barrier_t end;
+};
+
+struct worker {
+	struct run	*run;
+	unsigned	id;
+};
+
+
+static enum bench_format format = bench_text;
+static unsigned reps = 10;
+static unsigned warmup = 2;
+static unsigned max_threads;
+static unsigned target_ms = 20;
+static char **names;
+static unsigned n_names;
+static unsigned results = 0;
+
+
+/* ----- Measurement ------------------------------------------------------- */
+
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static void *worker(void *arg)
+{
+	const struct worker *w = arg;
+	struct run *run = w->run;
+	unsigned r;
+
+	for (r = 0; r != run->rounds; r++) {
+		pthread_barrier_wait(&run->start);
+		run->fn(run->user, w->id, run->n);
+		pthread_barrier_wait(&run->end);
+	}
+	return NULL;
+}
+
+
+/* run "rounds" repetitions with "threads" threads, and record their times */
+
+static void measure(struct run *run, unsigned threads, double *t)
+{
+	struct worker w[threads];
+	pthread_t thread[threads];
+	unsigned i, r;
+	double t0;
+
+	pthread_barrier_init(&run->start, NULL, threads + 1);
+	pthread_barrier_init(&run->end, NULL, threads + 1);
+	for (i = 0; i != threads; i++) {
+		w[i].run = run;
+		w[i].id = i;
+		thread[i] = thread_create(worker, w + i, "bench-%u", i);
+	}
+	for (r = 0; r != run->rounds; r++) {
+		pthread_barrier_wait(&run->start);
+		t0 = now();
+		pthread_barrier_wait(&run->end);
+		t[r] = now() - t0;
+	}
+	for (i = 0; i != threads; i++)
+		thread_join(thread[i]);
+	pthread_barrier_destroy(&run->start);
+	pthread_barrier_destroy(&run->end);
+}
+
+
+/* double n until a repetition takes at least 1/8 of the target */
+
+static void calibrate(struct run *run)
+{
+	double target = target_ms * 1e-3;
+	double t;
+
+	run->n = 1;
+	while (1) {
+		t = now();
+		run->fn(run->user, 0, run->n);
+		t = now() - t;
+		if (t >= target / 8)
+			break;
+		run->n *= 2;
+	}
+	run->n = run->n * target / t;
+	if (!run->n)
+		run->n = 1;
+}
+
+
+/* ----- Output ------------------------------------------------------------ */
+
+
+static void report(const char *name, unsigned threads, uint64_t n,
+    double mean, double stddev, double min)
+{
+	switch (format) {
+	case bench_text:
+		if (!results)
+			printf("%-28s %7s %10s %10s %10s %10s\n", "name",
+			    "threads", "ops", "ns/op", "stddev", "min");
+		printf("%-28s %7u %10llu %10.1f %10.1f %10.1f\n",
+		    name, threads, (unsigned long long) n, mean, stddev, min);
+		break;
+	case bench_csv:
+		if (!results)
+			printf("name,threads,ops,reps,ns_per_op,stddev,min\n");
+		printf("%s,%u,%llu,%u,%.2f,%.2f,%.2f\n",
+		    name, threads, (unsigned long long) n, reps,
+		    mean, stddev, min);
+		break;
+	case bench_json:
+		printf("%s\n  { \"name\": \"%s\", \"threads\": %u, "
+		    "\"ops\": %llu, \"reps\": %u,\n"
+		    "    \"ns_per_op\": %.2f, \"stddev\": %.2f, "
+		    "\"min\": %.2f }",
+		    results ? "," : "[", name, threads,
+		    (unsigned long long) n, reps, mean, stddev, min);
+		break;
+	}
+	fflush(stdout);
+	results++;
+}
+
+
+static void stats(const char *name, unsigned threads, uint64_t n,
+    const double *t)
+{
+	double sum = 0, sq = 0, min = 0;
+	double mean, v;
+	unsigned i;
+
+	for (i = 0; i != reps; i++) {
+		v = t[warmup + i] * 1e9 / n;
+		sum += v;
+		sq += v * v;
+		if (!i || v < min)
+			min = v;
+	}
+	mean = sum / reps;
+	v = reps > 1 ? (sq - sum * mean) / (reps - 1) : 0;
+	report(name, threads, n, mean, v > 0 ? sqrt(v) : 0, min);
+}
+
+
+/* ----- API --------------------------------------------------------------- */
+
+
+static bool selected(const char *name)
+{
+	unsigned i;
+
+	if (!n_names)
+		return 1;
+	for (i = 0; i != n_names; i++)
+		if (!strcmp(names[i], name))
+			return 1;
+	return 0;
+}
+
+
+void bench_run(const char *name,
+    void (*fn)(void *user, unsigned thread, uint64_t n), void *user,
+    unsigned flags)
+{
+	struct run run = {
+		.fn	= fn,
+		.user	= user,
+		.rounds	= warmup + reps,
+	};
+	double t[warmup + reps];
+	unsigned threads = 1;
+
+	/* we don't quote CSV fields or escape JSON strings */
+	assert(!strpbrk(name, "\"\\,"));
+	if (!selected(name))
+		return;
+	calibrate(&run);
+	while (1) {
+		measure(&run, threads, t);
+		stats(name, threads, run.n, t);
+		if (!(flags & BENCH_SCALE) || threads == max_threads)
+			break;
+		threads *= 2;
+		if (threads > max_threads)
+			threads = max_threads;
+	}
+}
+
+
+void bench_end(void)
+{
+	if (format == bench_json)
+		printf("%s]\n", results ? "\n" : "[");
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"usage: %s [-f text|csv|json] [-m ms] [-r reps] [-t threads] [-w reps]\n"
+"       %*s [name ...]\n", name, (int) strlen(name), "");
+	exit(1);
+}
+
+
+void bench_init(int argc, char **argv)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int c;
+
+	max_threads = cpus > 0 ? cpus : 1;
+	while ((c = getopt(argc, argv, "f:m:r:t:w:")) != EOF)
+		switch (c) {
+		case 'f':
+			if (!strcmp(optarg, "text"))
+				format = bench_text;
+			else if (!strcmp(optarg, "csv"))
+				format = bench_csv;
+			else if (!strcmp(optarg, "json"))
+				format = bench_json;
+			else
+				usage(*argv);
+			break;
+		case 'm':
+			target_ms = atoi(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		default:
+			usage(*argv);
+		}
+	if (!target_ms || !reps || !max_threads)
+		usage(*argv);
+	names = argv + optind;
+	n_names = argc - optind;
+}
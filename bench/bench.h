@@ -0,0 +1,46 @@
+/*
+ * bench/bench.h - Microbenchmark harness
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * A benchmark is a function that performs "n" operations. The harness picks n
+ * such that one repetition takes about the target time, discards the warmup
+ * repetitions, and reports the mean, standard deviation, and minimum of the
+ * time per operation over the others.
+ *
+ * Benchmarks run with BENCH_SCALE are repeated with 1, 2, 4, ... threads, up
+ * to the number of online CPUs, which all call the function at the same time.
+ * The time per operation is per thread, so perfect scaling yields the same
+ * time for any number of threads.
+ *
+ * Options:
+ *
+ * -f text|csv|json	output format (default: text)
+ * -r reps		repetitions (default: 10)
+ * -w reps		warmup repetitions (default: 2)
+ * -t threads		maximum number of threads (default: online CPUs)
+ * -m ms		target time per repetition (default: 20 ms)
+ * name ...		run only these benchmarks
+ */
+
+#ifndef BENCH_H
+#define	BENCH_H
+
+#include <stdint.h>
+
+
+#define	BENCH_SCALE	1	/* run with 1 to N threads */
+
+
+void bench_init(int argc, char **argv);
+void bench_run(const char *name,
+    void (*fn)(void *user, unsigned thread, uint64_t n), void *user,
+    unsigned flags);
+void bench_end(void);
+
+#endif /* !BENCH_H */
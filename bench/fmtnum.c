@@ -0,0 +1,93 @@
+/*
+ * bench/fmtnum.c - Compare the fmtnum converters with snprintf
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "fmtnum.h"
+
+#include "bench.h"
+
+
+#define	N	(1 << 12)	/* values per set; power of two */
+
+
+static uint64_t u64[N];
+static double temps[N];
+static double doubles[N];
+static volatile unsigned sink;
+
+
+static uint64_t rnd(void)
+{
+	static uint64_t s = 88172645463325252ull;
+
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return s;
+}
+
+
+/* define a benchmark "fn", where "expr" converts value i */
+
+#define	BENCH(fn, expr)							\
+    static void fn(void *user, unsigned thread, uint64_t n)		\
+    {									\
+	char buf[64];							\
+	uint64_t j;							\
+	unsigned i;							\
+									\
+	for (j = 0; j != n; j++) {					\
+		i = j & (N - 1);					\
+		sink += (expr);						\
+	}								\
+    }
+
+BENCH(snprintf_llu, snprintf(buf, sizeof(buf), "%llu",
+    (unsigned long long) u64[i]))
+BENCH(u64_dec, fmtnum_u64(buf, u64[i]))
+BENCH(snprintf_llx, snprintf(buf, sizeof(buf), "%llx",
+    (unsigned long long) u64[i]))
+BENCH(u64_hex, fmtnum_hex(buf, u64[i], 0))
+BENCH(snprintf_fixed, snprintf(buf, sizeof(buf), "%.2f", temps[i]))
+BENCH(fixed, fmtnum_fixed(buf, sizeof(buf), temps[i], 2))
+BENCH(snprintf_g_temp, snprintf(buf, sizeof(buf), "%g", temps[i]))
+BENCH(double_temp, fmtnum_double(buf, temps[i]))
+BENCH(snprintf_17g, snprintf(buf, sizeof(buf), "%.17g", doubles[i]))
+BENCH(double_any, fmtnum_double(buf, doubles[i]))
+
+
+int main(int argc, char **argv)
+{
+	unsigned i;
+
+	bench_init(argc, argv);
+	for (i = 0; i != N; i++) {
+		u64[i] = rnd() >> (rnd() & 63);
+		/* e.g., a temperature in centi-degrees */
+		temps[i] = (double) (rnd() % 12000) / 100;
+		doubles[i] = (double) (rnd() >> 11) / (1ull << 53) * 1e6;
+	}
+
+	bench_run("snprintf %llu", snprintf_llu, NULL, 0);
+	bench_run("fmtnum_u64", u64_dec, NULL, 0);
+	bench_run("snprintf %llx", snprintf_llx, NULL, 0);
+	bench_run("fmtnum_hex", u64_hex, NULL, 0);
+	bench_run("snprintf %.2f", snprintf_fixed, NULL, 0);
+	bench_run("fmtnum_fixed 2", fixed, NULL, 0);
+	bench_run("snprintf %g (temp)", snprintf_g_temp, NULL, 0);
+	bench_run("fmtnum_double (temp)", double_temp, NULL, 0);
+	bench_run("snprintf %.17g", snprintf_17g, NULL, 0);
+	bench_run("fmtnum_double", double_any, NULL, 0);
+	bench_end();
+	return 0;
+}
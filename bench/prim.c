@@ -0,0 +1,165 @@
+/*
+ * bench/prim.c - Cost of the thread, dtime, and alloc primitives
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "alloc.h"
+#include "dtime.h"
+#include "thread.h"
+
+#include "bench.h"
+
+
+#define	APPENDS	32	/* per string, before starting over */
+
+
+struct pingpong {
+	struct thread_wait	ping;
+	struct thread_wait	pong;
+	uint64_t		n;
+};
+
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_wait waiter;
+static struct dtime dt;
+static volatile double sink;
+
+
+/* ----- thread ------------------------------------------------------------ */
+
+
+static void lock_unlock(void *user, unsigned thread, uint64_t n)
+{
+	while (n--) {
+		lock(&mutex);
+		unlock(&mutex);
+	}
+}
+
+
+static void wake_up_only(void *user, unsigned thread, uint64_t n)
+{
+	while (n--)
+		wake_up(&waiter);
+}
+
+
+static void *pong(void *arg)
+{
+	struct pingpong *pp = arg;
+	uint64_t i;
+
+	for (i = 0; i != pp->n; i++) {
+		wait_on(&pp->ping);
+		wake_up(&pp->pong);
+	}
+	return NULL;
+}
+
+
+/* one operation is a round trip to another thread */
+
+static void ping(void *user, unsigned thread, uint64_t n)
+{
+	struct pingpong pp = {
+		.n	= n,
+	};
+	pthread_t t;
+
+	begin_wait(&pp.ping);
+	begin_wait(&pp.pong);
+	t = thread_create(pong, &pp, "pong-%u", thread);
+	while (n--) {
+		wake_up(&pp.ping);
+		wait_on(&pp.pong);
+	}
+	thread_join(t);
+	end_wait(&pp.ping);
+	end_wait(&pp.pong);
+}
+
+
+static void *nop(void *arg)
+{
+	return NULL;
+}
+
+
+static void create_join(void *user, unsigned thread, uint64_t n)
+{
+	while (n--)
+		thread_join(thread_create(nop, NULL, "nop-%u", thread));
+}
+
+
+/* ----- dtime ------------------------------------------------------------- */
+
+
+static void dtime_s_now(void *user, unsigned thread, uint64_t n)
+{
+	while (n--)
+		sink = dtime_s(&dt, NULL);
+}
+
+
+/* "timeout_s" is a double, passed by reference */
+
+static void timeout(void *user, unsigned thread, uint64_t n)
+{
+	double timeout_s = *(const double *) user;
+
+	while (n--)
+		sink = dtime_timeout(&dt, timeout_s, NULL);
+}
+
+
+/* ----- alloc ------------------------------------------------------------- */
+
+
+static void append(void *user, unsigned thread, uint64_t n)
+{
+	char *s = NULL;
+	uint64_t i;
+
+	for (i = 0; i != n; i++) {
+		if (!(i % APPENDS)) {
+			free(s);
+			s = NULL;
+		}
+		s = stralloc_append(s, "abc");
+	}
+	free(s);
+}
+
+
+int main(int argc, char **argv)
+{
+	static const double never = 3600;
+	static const double always = 0;
+
+	bench_init(argc, argv);
+	begin_wait(&waiter);
+	dtime_init(&dt);
+
+	bench_run("lock", lock_unlock, NULL, BENCH_SCALE);
+	bench_run("wake_up", wake_up_only, NULL, BENCH_SCALE);
+	bench_run("wake_up/wait_on", ping, NULL, BENCH_SCALE);
+	bench_run("thread_create", create_join, NULL, BENCH_SCALE);
+	bench_run("dtime_s", dtime_s_now, NULL, BENCH_SCALE);
+	bench_run("dtime_timeout", timeout, (void *) &never, BENCH_SCALE);
+	bench_run("dtime_timeout (expiring)", timeout, (void *) &always,
+	    BENCH_SCALE);
+	bench_run("stralloc_append", append, NULL, BENCH_SCALE);
+	bench_end();
+	return 0;
+}
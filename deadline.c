@@ -0,0 +1,179 @@
+/*
+ * deadline.c - Track timeouts of many entities
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "alloc.h"
+#include "thread.h"
+#include "deadline.h"
+
+
+/* ----- Binary min-heap --------------------------------------------------- */
+
+
+static void set(struct deadline_heap *h, unsigned i, struct deadline *d)
+{
+	h->heap[i] = d;
+	d->index = i;
+}
+
+
+static void sift_up(struct deadline_heap *h, unsigned i)
+{
+	struct deadline *d = h->heap[i];
+
+	while (i) {
+		unsigned parent = (i - 1) / 2;
+
+		if (h->heap[parent]->due <= d->due)
+			break;
+		set(h, i, h->heap[parent]);
+		i = parent;
+	}
+	set(h, i, d);
+}
+
+
+static void sift_down(struct deadline_heap *h, unsigned i)
+{
+	struct deadline *d = h->heap[i];
+
+	while (1) {
+		unsigned child = 2 * i + 1;
+
+		if (child >= h->n)
+			break;
+		if (child + 1 < h->n &&
+		    h->heap[child + 1]->due < h->heap[child]->due)
+			child++;
+		if (d->due <= h->heap[child]->due)
+			break;
+		set(h, i, h->heap[child]);
+		i = child;
+	}
+	set(h, i, d);
+}
+
+
+static void update(struct deadline_heap *h, struct deadline *d, int64_t due)
+{
+	bool later = due > d->due;
+
+	d->due = due;
+	if (later)
+		sift_down(h, d->index);
+	else
+		sift_up(h, d->index);
+}
+
+
+/* ----- Operations -------------------------------------------------------- */
+
+
+void deadline_init(struct deadline *d)
+{
+	d->index = DEADLINE_IDLE;
+}
+
+
+void deadline_touch(struct deadline_heap *h, struct deadline *d, int64_t now)
+{
+	lock(&h->mutex);
+	if (d->index != DEADLINE_IDLE) {
+		update(h, d, now + h->timeout_ns);
+	} else {
+		if (h->n == h->size) {
+			h->size = h->size ? 2 * h->size : 16;
+			h->heap = realloc_type_n(h->heap, h->size);
+		}
+		d->due = now + h->timeout_ns;
+		set(h, h->n++, d);
+		sift_up(h, d->index);
+	}
+	unlock(&h->mutex);
+}
+
+
+void deadline_remove(struct deadline_heap *h, struct deadline *d)
+{
+	unsigned i;
+
+	lock(&h->mutex);
+	i = d->index;
+	if (i != DEADLINE_IDLE) {
+		struct deadline *last = h->heap[--h->n];
+
+		d->index = DEADLINE_IDLE;
+		if (last != d) {
+			set(h, i, last);
+			sift_up(h, i);
+			sift_down(h, last->index);
+		}
+	}
+	unlock(&h->mutex);
+}
+
+
+unsigned deadline_expired(struct deadline_heap *h, int64_t now,
+    void (*cb)(void *user, struct deadline *d), void *user)
+{
+	struct deadline *d;
+	unsigned n = 0;
+
+	assert(h->timeout_ns > 0);
+	lock(&h->mutex);
+	while (h->n && h->heap[0]->due <= now) {
+		d = h->heap[0];
+		update(h, d, now + h->timeout_ns);
+		unlock(&h->mutex);
+		cb(user, d);
+		n++;
+		lock(&h->mutex);
+	}
+	unlock(&h->mutex);
+	return n;
+}
+
+
+int64_t deadline_next(struct deadline_heap *h)
+{
+	int64_t next;
+
+	lock(&h->mutex);
+	next = h->n ? h->heap[0]->due : INT64_MAX;
+	unlock(&h->mutex);
+	return next;
+}
+
+
+/* ----- Setup and teardown ------------------------------------------------ */
+
+
+void deadline_heap_init(struct deadline_heap *h, double timeout_s)
+{
+	pthread_mutex_init(&h->mutex, NULL);
+	h->heap = NULL;
+	h->n = h->size = 0;
+	h->timeout_ns = timeout_s * 1e9;
+}
+
+
+void deadline_heap_destroy(struct deadline_heap *h)
+{
+	unsigned i;
+
+	for (i = 0; i != h->n; i++)
+		h->heap[i]->index = DEADLINE_IDLE;
+	free(h->heap);
+	mutex_destroy(&h->mutex);
+}
@@ -0,0 +1,69 @@
+/*
+ * deadline.h - Track timeouts of many entities
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * A deadline heap replaces one struct dtime per monitored entity, checked with
+ * dtime_timeout on every tick. Each entity embeds a struct deadline (use
+ * container_of to get back to the entity), and "touching" it moves its
+ * deadline to "now" plus the timeout of the heap. deadline_expired then only
+ * visits entities that are due.
+ *
+ * Times are in nanoseconds, as returned by dtime_now_ns.
+ */
+
+#ifndef LINZHI_LIBCOMMON_DEADLINE_H
+#define	LINZHI_LIBCOMMON_DEADLINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+
+#define	DEADLINE_IDLE	(~0u)	/* index of a deadline not in any heap */
+
+
+struct deadline {
+	int64_t		due;
+	unsigned	index;
+};
+
+struct deadline_heap {
+	pthread_mutex_t	mutex;
+	struct deadline	**heap;
+	unsigned	n;
+	unsigned	size;
+	int64_t		timeout_ns;
+};
+
+
+void deadline_init(struct deadline *d);
+
+/* add "d" to the heap, or move its deadline if it is already there */
+
+void deadline_touch(struct deadline_heap *h, struct deadline *d, int64_t now);
+void deadline_remove(struct deadline_heap *h, struct deadline *d);
+
+/*
+ * Call "cb" for each deadline that is due at "now", and return their number.
+ * Like dtime_timeout, this re-arms each expired deadline, so the callback is
+ * invoked again after another timeout unless the entity is touched or removed
+ * in the meantime. The callback runs without the heap locked and may touch or
+ * remove deadlines.
+ */
+
+unsigned deadline_expired(struct deadline_heap *h, int64_t now,
+    void (*cb)(void *user, struct deadline *d), void *user);
+
+/* time of the next expiry, INT64_MAX if the heap is empty */
+
+int64_t deadline_next(struct deadline_heap *h);
+
+void deadline_heap_init(struct deadline_heap *h, double timeout_s);
+void deadline_heap_destroy(struct deadline_heap *h);
+
+#endif /* !LINZHI_LIBCOMMON_DEADLINE_H */
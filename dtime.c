@@ -12,9 +12,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
-#include <pthread.h>
-
-#include "thread.h"
+#include <stdatomic.h>
 
 #include "dtime.h"
 
@@ -28,94 +26,128 @@ void dtime_get(struct timespec *t)
 }
 
 
-void dtime_set(struct dtime *dt, const struct timespec *t)
+static __thread bool cached = 0;
+static __thread int64_t cached_now;
+
+
+static int64_t ts_to_ns(const struct timespec *t)
+{
+	return (int64_t) t->tv_sec * DTIME_NS_PER_S + t->tv_nsec;
+}
+
+
+int64_t dtime_clock_ns(void)
 {
 	struct timespec now;
 
-	if (!t) {
-		dtime_get(&now);
-		t = &now;
-	}
+	dtime_get(&now);
+	return ts_to_ns(&now);
+}
 
-	lock(&dt->mutex);
-	dt->t0 = *t;
-	unlock(&dt->mutex);
+
+int64_t dtime_now_ns(void)
+{
+	return cached ? cached_now : dtime_clock_ns();
 }
 
 
-static double delta(struct dtime *dt, const struct timespec *t)
+static int64_t now_ns(const struct timespec *t)
 {
-	return (t->tv_sec - dt->t0.tv_sec) +
-	    (t->tv_nsec - dt->t0.tv_nsec) * 1e-9;
+	return t ? ts_to_ns(t) : dtime_now_ns();
+}
+
+
+/* ----- Nanosecond interface ---------------------------------------------- */
+
+
+void dtime_set_ns(struct dtime *dt, int64_t now)
+{
+	atomic_store_explicit(&dt->t0, now, memory_order_relaxed);
+}
+
+
+int64_t dtime_ns(struct dtime *dt, int64_t now)
+{
+	return now - atomic_load_explicit(&dt->t0, memory_order_relaxed);
+}
+
+
+int64_t dtime_step_ns(struct dtime *dt, int64_t now)
+{
+	return now - atomic_exchange_explicit(&dt->t0, now,
+	    memory_order_relaxed);
+}
+
+
+bool dtime_timeout_ns(struct dtime *dt, int64_t timeout_ns, int64_t now)
+{
+	int64_t t0 = atomic_load_explicit(&dt->t0, memory_order_relaxed);
+
+	do {
+		if (now - t0 < timeout_ns)
+			return 0;
+	} while (!atomic_compare_exchange_weak_explicit(&dt->t0, &t0, now,
+	    memory_order_relaxed, memory_order_relaxed));
+	return 1;
+}
+
+
+/* ----- Per-thread time cache --------------------------------------------- */
+
+
+int64_t dtime_cache_refresh(void)
+{
+	cached_now = dtime_clock_ns();
+	cached = 1;
+	return cached_now;
+}
+
+
+void dtime_cache_clear(void)
+{
+	cached = 0;
+}
+
+
+/* ----- Seconds interface ------------------------------------------------- */
+
+
+void dtime_set(struct dtime *dt, const struct timespec *t)
+{
+	dtime_set_ns(dt, now_ns(t));
 }
 
 
 double dtime_s(struct dtime *dt, const struct timespec *t)
 {
-	struct timespec now;
-	double d;
+	int64_t now = now_ns(t);
 
-	if (!t) {
-		dtime_get(&now);
-		t = &now;
-	}
-	if (dt) {
-		lock(&dt->mutex);
-		d = delta(dt, t);
-		unlock(&dt->mutex);
-	} else {
-		return t->tv_sec + t->tv_nsec * 1e-9;
-	}
-	return d;
+	if (!dt)
+		return now * 1e-9;
+	return dtime_ns(dt, now) * 1e-9;
 }
 
 
 double dtime_step_s(struct dtime *dt, const struct timespec *t)
 {
-	struct timespec now;
-	double d;
-
-	if (!t) {
-		dtime_get(&now);
-		t = &now;
-	}
-	lock(&dt->mutex);
-	d = delta(dt, t);
-	dt->t0 = *t;
-	unlock(&dt->mutex);
-	return d;
+	return dtime_step_ns(dt, now_ns(t)) * 1e-9;
 }
 
 
 bool dtime_timeout(struct dtime *dt, double timeout_s, const struct timespec *t)
 {
-	struct timespec now;
-	bool to;
-
-	if (!t) {
-		dtime_get(&now);
-		t = &now;
-	}
-	lock(&dt->mutex);
-	to = delta(dt, t) >= timeout_s;
-	if (to)
-		dt->t0 = *t;
-	unlock(&dt->mutex);
-	return to;
+	return dtime_timeout_ns(dt, timeout_s * 1e9, now_ns(t));
 }
 
 
 void dtime_reset(struct dtime *dt)
 {
-	struct timespec ts;
-
-	dtime_get(&ts);
-	dtime_set(dt, &ts);
+	dtime_set(dt, NULL);
 }
 
 
 void dtime_init(struct dtime *dt)
 {
-	pthread_mutex_init(&dt->mutex, NULL);
+	atomic_init(&dt->t0, 0);
 	dtime_reset(dt);
 }
@@ -13,12 +13,16 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
-#include <pthread.h>
+#include <stdatomic.h>
 
 
+/*
+ * t0 is kept as a single 64-bit nanosecond value on the boot time clock, so
+ * that all operations are lock-free.
+ */
+
 struct dtime {
-	pthread_mutex_t mutex;
-	struct timespec t0;
+	_Atomic int64_t t0;
 };
 
 
@@ -26,8 +30,11 @@ void dtime_get(struct timespec *t);
 
 /*
  * Warning: if used to obtain cumulative intervals, dtime_set will only yield
- * correct results if no locking is needed. Else, use dtime_step_s to ensure
- * that no overlapping get/set sequences can occur.
+ * correct results if no synchronization is needed. Else, use dtime_step_s to
+ * ensure that no overlapping get/set sequences can occur.
+ *
+ * dtime_timeout checks and re-arms atomically: of several threads that see
+ * the same timeout, only one gets "true".
  */
 
 void dtime_set(struct dtime *dt, const struct timespec *t);
@@ -39,4 +46,32 @@ bool dtime_timeout(struct dtime *dt, double timeout_s,
 void dtime_reset(struct dtime *dt);
 void dtime_init(struct dtime *dt);
 
+/*
+ * Integer nanosecond variants. "now" is a time obtained with dtime_now_ns.
+ * dtime_clock_ns always reads the clock, ignoring the cache below.
+ */
+
+#define	DTIME_NS_PER_S	1000000000LL
+
+int64_t dtime_clock_ns(void);
+int64_t dtime_now_ns(void);
+void dtime_set_ns(struct dtime *dt, int64_t now);
+int64_t dtime_ns(struct dtime *dt, int64_t now);
+int64_t dtime_step_ns(struct dtime *dt, int64_t now);
+bool dtime_timeout_ns(struct dtime *dt, int64_t timeout_ns, int64_t now);
+
+/*
+ * Per-thread cache of the current time, e.g., for an event loop that checks
+ * many timeouts per iteration. After dtime_cache_refresh, dtime_now_ns and all
+ * dtime_* functions called with t == NULL in the same thread use the time of
+ * the refresh instead of reading the clock, until dtime_cache_clear.
+ *
+ * Code that may run in such a thread without knowing it, e.g., library code
+ * or a callback, and that needs the time to advance or to be consistent with
+ * other threads, must use dtime_clock_ns instead.
+ */
+
+int64_t dtime_cache_refresh(void);
+void dtime_cache_clear(void);
+
 #endif /* !LINZHI_LIBCOMMON_DTIME_H */
@@ -0,0 +1,225 @@
+/*
+ * fmtnum.c - Fast number to text conversion
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Integers are converted two digits at a time, from a table, after counting
+ * the digits, so that they can be written in place.
+ *
+ * For doubles, we look for the fewest decimals k such that v = m / 10^k with
+ * an integer m < 2^53. Since m and 10^k (k <= 22) are exact, the division
+ * rounds correctly, just like strtod, so a match is guaranteed to read back
+ * as "v". Values that need 17 digits, or that are very large or small, are
+ * passed to snprintf.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "fmtnum.h"
+
+
+#define	EXACT_INT	9007199254740992.0	/* 2^53 */
+#define	MAX_EXACT_POW	22			/* 10^22 is exact */
+#define	MAX_FIXED	1e12	/* beyond, rounding errors may reach ~1e-4 */
+#define	MAX_FIXED_PREC	17
+#define	TIE_MARGIN	1e-3	/* use snprintf if this close to a tie */
+
+
+static const char digits2[200] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+static const uint64_t pow10i[20] = {
+	1ull,
+	10ull,
+	100ull,
+	1000ull,
+	10000ull,
+	100000ull,
+	1000000ull,
+	10000000ull,
+	100000000ull,
+	1000000000ull,
+	10000000000ull,
+	100000000000ull,
+	1000000000000ull,
+	10000000000000ull,
+	100000000000000ull,
+	1000000000000000ull,
+	10000000000000000ull,
+	100000000000000000ull,
+	1000000000000000000ull,
+	10000000000000000000ull,
+};
+
+static const double pow10d[MAX_EXACT_POW + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/* ----- Integers ---------------------------------------------------------- */
+
+
+static unsigned count_digits(uint64_t v)
+{
+	unsigned n;
+
+	if (v < 10)
+		return 1;
+	/* log10(2) ~ 1233 / 4096 */
+	n = ((64 - __builtin_clzll(v)) * 1233) >> 12;
+	return n + (v >= pow10i[n]);
+}
+
+
+/* write the digits of "v" backwards, ending before "end" */
+
+static void write_dec(char *end, uint64_t v)
+{
+	while (v >= 100) {
+		const char *d = digits2 + 2 * (v % 100);
+
+		v /= 100;
+		*--end = d[1];
+		*--end = d[0];
+	}
+	if (v >= 10) {
+		*--end = digits2[2 * v + 1];
+		*--end = digits2[2 * v];
+	} else {
+		*--end = '0' + v;
+	}
+}
+
+
+unsigned fmtnum_u64(char *buf, uint64_t v)
+{
+	unsigned n = count_digits(v);
+
+	write_dec(buf + n, v);
+	buf[n] = 0;
+	return n;
+}
+
+
+unsigned fmtnum_i64(char *buf, int64_t v)
+{
+	if (v >= 0)
+		return fmtnum_u64(buf, v);
+	*buf = '-';
+	return 1 + fmtnum_u64(buf + 1, -(uint64_t) v);
+}
+
+
+unsigned fmtnum_hex(char *buf, uint64_t v, bool upper)
+{
+	const char *digit = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	unsigned n = v ? (67 - __builtin_clzll(v)) >> 2 : 1;
+	char *p = buf + n;
+
+	*p = 0;
+	do {
+		*--p = digit[v & 15];
+		v >>= 4;
+	} while (v);
+	return n;
+}
+
+
+/* ----- Doubles ----------------------------------------------------------- */
+
+
+/* m / 10^k, with exactly k decimals */
+
+static unsigned put_fixed(char *buf, bool neg, uint64_t m, unsigned k)
+{
+	uint64_t frac = m % pow10i[k];
+	char *p = buf;
+
+	if (neg)
+		*p++ = '-';
+	p += fmtnum_u64(p, m / pow10i[k]);
+	if (k) {
+		*p++ = '.';
+		write_dec(p + k, frac);
+		memset(p, '0', k - count_digits(frac));
+		p += k;
+	}
+	*p = 0;
+	return p - buf;
+}
+
+
+unsigned fmtnum_double(char *buf, double v)
+{
+	double a = fabs(v);
+	unsigned k, digits = 15;
+
+	if (v == 0)
+		return put_fixed(buf, signbit(v), 0, 0);
+	/* the range in which %g does not use an exponent */
+	if (a >= 1e-4 && a < 1e15) {
+		for (k = 0; k <= MAX_EXACT_POW; k++) {
+			double x = a * pow10d[k];
+			double m;
+
+			if (x >= EXACT_INT) {
+				/* no candidate of up to 15 digits matched */
+				digits = 16;
+				break;
+			}
+			m = (double) (uint64_t) (x + 0.5);
+			if (m / pow10d[k] == a)
+				return put_fixed(buf, v < 0, m, k);
+		}
+	}
+	for (; digits != 17; digits++) {
+		snprintf(buf, FMTNUM_DOUBLE_MAX, "%.*g", digits, v);
+		if (strtod(buf, NULL) == v)
+			return strlen(buf);
+	}
+	return snprintf(buf, FMTNUM_DOUBLE_MAX, "%.17g", v);
+}
+
+
+size_t fmtnum_fixed(char *buf, size_t size, double v, unsigned prec)
+{
+	double a = fabs(v);
+	char tmp[FMTNUM_DOUBLE_MAX];
+	unsigned len;
+
+	if (prec <= MAX_FIXED_PREC && a * pow10d[prec] < MAX_FIXED) {
+		double x = a * pow10d[prec];
+		uint64_t m = x;
+		double frac = x - m;
+
+		/* glibc rounds the exact binary value, which a tie hides */
+		if (fabs(frac - 0.5) > TIE_MARGIN) {
+			m += frac > 0.5;
+			len = put_fixed(tmp, signbit(v), m, prec);
+			if (size) {
+				size_t n = len < size ? len : size - 1;
+
+				memcpy(buf, tmp, n);
+				buf[n] = 0;
+			}
+			return len;
+		}
+	}
+	return snprintf(buf, size, "%.*f", (int) prec, v);
+}
@@ -0,0 +1,51 @@
+/*
+ * fmtnum.h - Fast number to text conversion
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * The functions write a NUL-terminated string into a buffer provided by the
+ * caller, and return its length. The output is the same as printf's, with the
+ * format given in the comments.
+ */
+
+#ifndef LINZHI_LIBCOMMON_FMTNUM_H
+#define	LINZHI_LIBCOMMON_FMTNUM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* buffer sizes, including the NUL */
+
+#define	FMTNUM_U64_MAX		21
+#define	FMTNUM_I64_MAX		21
+#define	FMTNUM_HEX_MAX		17
+#define	FMTNUM_DOUBLE_MAX	32
+
+
+unsigned fmtnum_u64(char *buf, uint64_t v);		/* %llu */
+unsigned fmtnum_i64(char *buf, int64_t v);		/* %lld */
+unsigned fmtnum_hex(char *buf, uint64_t v, bool upper);	/* %llx, %llX */
+
+/*
+ * The fewest digits that strtod reads back as "v", e.g., 0.1 instead of
+ * 0.10000000000000001 (%.17g). Like %g, but numbers from 1e-4 up to 1e15 are
+ * never written with an exponent, e.g., 1000 instead of 1e+03.
+ */
+
+unsigned fmtnum_double(char *buf, double v);
+
+/*
+ * %.*f. Like snprintf, fmtnum_fixed writes at most "size" bytes and returns
+ * the length of the complete output.
+ */
+
+size_t fmtnum_fixed(char *buf, size_t size, double v, unsigned prec);
+
+#endif /* !LINZHI_LIBCOMMON_FMTNUM_H */
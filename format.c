@@ -1,50 +1,709 @@
 /*
- * format.c - Check if printf-style format string matches pattern
+ * format.c - Check and compile printf-style format strings
  *
- * Copyright (C) 2021 Linzhi Ltd.
+ * Copyright (C) 2021, 2023 Linzhi Ltd.
  *
  * This work is licensed under the terms of the MIT License.
  * A copy of the license can be found in the file COPYING.txt
  */
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
 
+#include "linzhi/alloc.h"
+#include "linzhi/fmtnum.h"
 #include "linzhi/format.h"
 
 
+#define	MAX_SIG		6	/* "**hhd" plus one spare */
+#define	MAX_FIELD	100000	/* width or precision */
+
+
+static const char *const len_name[] = {
+	[format_len_none]	= "",
+	[format_len_hh]		= "hh",
+	[format_len_h]		= "h",
+	[format_len_l]		= "l",
+	[format_len_ll]		= "ll",
+	[format_len_j]		= "j",
+	[format_len_z]		= "z",
+	[format_len_t]		= "t",
+	[format_len_L]		= "L",
+};
+
+
+/* ----- Parsing ----------------------------------------------------------- */
+
+
+static const char *parse_number(const char *s, int *res)
+{
+	*res = 0;
+	while (*s >= '0' && *s <= '9') {
+		*res = *res * 10 + *s++ - '0';
+		if (*res > MAX_FIELD)
+			return NULL;
+	}
+	return s;
+}
+
+
+/*
+ * printf accepts flags, width, and precision before a literal %, and ignores
+ * them, e.g., "%5%" prints just %. If "s" (after the %) is such a literal,
+ * return the character after it, and set "stars" to the number of * it
+ * contains. Else, return NULL.
+ */
+
+static const char *parse_literal(const char *s, unsigned *stars)
+{
+	*stars = 0;
+	while (*s && strchr("-+ #0123456789.*", *s))
+		if (*s++ == '*')
+			(*stars)++;
+	return *s == '%' ? s + 1 : NULL;
+}
+
+
+/*
+ * Parse the conversion specification after the %. Returns the character after
+ * it, or NULL if the specification is invalid or not supported.
+ */
+
+static const char *parse_conv(const char *s, struct format_conv *c)
+{
+	c->flags = 0;
+	c->width = c->prec = -1;
+	c->len = format_len_none;
+
+	while (1) {
+		switch (*s) {
+		case '-':
+			c->flags |= FORMAT_LEFT;
+			break;
+		case '+':
+			c->flags |= FORMAT_PLUS;
+			break;
+		case ' ':
+			c->flags |= FORMAT_SPACE;
+			break;
+		case '#':
+			c->flags |= FORMAT_ALT;
+			break;
+		case '0':
+			c->flags |= FORMAT_ZERO;
+			break;
+		default:
+			goto width;
+		}
+		s++;
+	}
+
+width:
+	if (*s == '*') {
+		c->width = FORMAT_STAR;
+		s++;
+	} else if (*s >= '1' && *s <= '9') {
+		s = parse_number(s, &c->width);
+		if (!s)
+			return NULL;
+	}
+	if (*s == '.') {
+		s++;
+		if (*s == '*') {
+			c->prec = FORMAT_STAR;
+			s++;
+		} else {
+			s = parse_number(s, &c->prec);
+			if (!s)
+				return NULL;
+		}
+	}
+
+	switch (*s) {
+	case 'h':
+		c->len = s[1] == 'h' ? format_len_hh : format_len_h;
+		break;
+	case 'l':
+		c->len = s[1] == 'l' ? format_len_ll : format_len_l;
+		break;
+	case 'j':
+		c->len = format_len_j;
+		break;
+	case 'z':
+		c->len = format_len_z;
+		break;
+	case 't':
+		c->len = format_len_t;
+		break;
+	case 'L':
+		c->len = format_len_L;
+		break;
+	default:
+		break;
+	}
+	s += strlen(len_name[c->len]);
+
+	c->conv = *s++;
+	switch (c->conv) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		return c->len == format_len_L ? NULL : s;
+	case 'c':
+	case 's':
+	case 'p':
+		return c->len == format_len_none ? s : NULL;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (c->len == format_len_l)
+			c->len = format_len_none;
+		return c->len == format_len_none || c->len == format_len_L ?
+		    s : NULL;
+	default:
+		// unrecognized or invalid syntax
+		return NULL;
+	}
+}
+
+
+static char field_type(char conv)
+{
+	switch (conv) {
+	case 'i':
+		return 'd';
+	case 'o':
+	case 'x':
+	case 'X':
+		return 'u';
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		return 'f';
+	default:
+		return conv;
+	}
+}
+
+
+static unsigned signature(const struct format_conv *c, char *buf)
+{
+	const char *len = len_name[c->len];
+	char *p = buf;
+
+	if (c->width == FORMAT_STAR)
+		*p++ = '*';
+	if (c->prec == FORMAT_STAR)
+		*p++ = '*';
+	while (*len)
+		*p++ = *len++;
+	*p++ = field_type(c->conv);
+	return p - buf;
+}
+
+
+static unsigned args(const struct format_conv *c)
+{
+	return 1 + (c->width == FORMAT_STAR) + (c->prec == FORMAT_STAR);
+}
+
+
 bool format_compatible(const char *fmt, const char *fields)
 {
+	struct format_conv c;
+	char sig[MAX_SIG];
+	const char *lit;
+	unsigned len, stars;
+
 	while (*fmt) {
 		if (*fmt++ != '%')
 			continue;
-		while (*fmt++) {
-			switch (fmt[-1]) {
-			case 'c':
-			case 'd':
-			case 'p':
-			case 's':
-			case 'u':
-				if (fmt[-1] != *fields++)
+		lit = parse_literal(fmt, &stars);
+		if (lit) {
+			while (stars--)
+				if (*fields++ != '*')
 					return 0;
+			fmt = lit;
+			continue;
+		}
+		fmt = parse_conv(fmt, &c);
+		if (!fmt)
+			return 0;
+		len = signature(&c, sig);
+		if (strncmp(fields, sig, len))
+			return 0;
+		fields += len;
+	}
+	return !*fields;
+}
+
+
+/* ----- Compilation ------------------------------------------------------- */
+
+
+struct format *format_compile(const char *fmt)
+{
+	struct format_conv c, *conv;
+	struct format *f;
+	unsigned n = 1, n_args = 0;
+	size_t sig_len = 0;
+	size_t len = strlen(fmt);
+	const char *s, *next;
+	char *text, *t, *sig;
+	unsigned lit = 0, stars;
+	char tmp[MAX_SIG];
+
+	for (s = fmt; *s; ) {
+		if (*s++ != '%')
+			continue;
+		next = parse_literal(s, &stars);
+		if (next) {
+			/* we would have to capture an argument for nothing */
+			if (stars)
+				return NULL;
+			s = next;
+			continue;
+		}
+		s = parse_conv(s, &c);
+		if (!s)
+			return NULL;
+		n++;
+		n_args += args(&c);
+		sig_len += signature(&c, tmp);
+	}
+
+	/* the text and the signature follow the conversions */
+	f = alloc_size(sizeof(struct format) +
+	    n * sizeof(struct format_conv) + len + 1 + sig_len + 1);
+	text = t = (char *) (f->conv + n);
+	sig = text + len + 1;
+	f->text = text;
+	f->sig = sig;
+	f->n_args = n_args;
+	f->n = n;
+
+	conv = f->conv;
+	for (s = fmt; *s; ) {
+		if (*s != '%') {
+			*t++ = *s++;
+			continue;
+		}
+		next = parse_literal(++s, &stars);
+		if (next) {
+			*t++ = '%';
+			s = next;
+			continue;
+		}
+		s = parse_conv(s, conv);
+		conv->lit = lit;
+		conv->lit_len = t - text - lit;
+		lit = t - text;
+		sig += signature(conv, sig);
+		conv++;
+	}
+	*t = 0;
+	*sig = 0;
+	conv->lit = lit;
+	conv->lit_len = t - text - lit;
+	conv->conv = 0;
+	return f;
+}
+
+
+void format_free(struct format *f)
+{
+	free(f);
+}
+
+
+bool format_check(const struct format *f, const char *fields)
+{
+	return !strcmp(f->sig, fields);
+}
+
+
+/* ----- Argument capture -------------------------------------------------- */
+
+
+void format_capture(const struct format *f, union format_arg *args,
+    va_list ap)
+{
+	const struct format_conv *c;
+
+	for (c = f->conv; c->conv; c++) {
+		if (c->width == FORMAT_STAR)
+			args++->i = va_arg(ap, int);
+		if (c->prec == FORMAT_STAR)
+			args++->i = va_arg(ap, int);
+		switch (c->conv) {
+		case 'd':
+		case 'i':
+			switch (c->len) {
+			case format_len_hh:
+				args->i = (signed char) va_arg(ap, int);
 				break;
-			case '%':
+			case format_len_h:
+				args->i = (short) va_arg(ap, int);
+				break;
+			case format_len_l:
+				args->i = va_arg(ap, long);
+				break;
+			case format_len_ll:
+				args->i = va_arg(ap, long long);
+				break;
+			case format_len_j:
+				args->i = va_arg(ap, intmax_t);
+				break;
+			case format_len_z:
+				args->i = va_arg(ap, ssize_t);
+				break;
+			case format_len_t:
+				args->i = va_arg(ap, ptrdiff_t);
 				break;
-			case '*':
-				if (*fields++ != '*')
-					return 0;
-				continue;
-			case '0' ... '9':
-			case '-':
-			case '+':
-			case '.':
-			case ' ':
-				continue;
 			default:
-				// unrecognized or invalid syntax
-				return 0;
+				args->i = va_arg(ap, int);
+				break;
+			}
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			switch (c->len) {
+			case format_len_hh:
+				args->u = (unsigned char) va_arg(ap, unsigned);
+				break;
+			case format_len_h:
+				args->u =
+				    (unsigned short) va_arg(ap, unsigned);
+				break;
+			case format_len_l:
+				args->u = va_arg(ap, unsigned long);
+				break;
+			case format_len_ll:
+				args->u = va_arg(ap, unsigned long long);
+				break;
+			case format_len_j:
+				args->u = va_arg(ap, uintmax_t);
+				break;
+			case format_len_z:
+				args->u = va_arg(ap, size_t);
+				break;
+			case format_len_t:
+				args->u = (size_t) va_arg(ap, ptrdiff_t);
+				break;
+			default:
+				args->u = va_arg(ap, unsigned);
+				break;
 			}
 			break;
+		case 'c':
+			args->i = va_arg(ap, int);
+			break;
+		case 's':
+			args->s = va_arg(ap, const char *);
+			break;
+		case 'p':
+			args->p = va_arg(ap, const void *);
+			break;
+		default:
+			if (c->len == format_len_L)
+				args->ld = va_arg(ap, long double);
+			else
+				args->d = va_arg(ap, double);
+			break;
 		}
+		args++;
 	}
-	return !*fields;
+}
+
+
+/* ----- Output ------------------------------------------------------------ */
+
+
+struct out {
+	char	*buf;
+	size_t	size;
+	size_t	pos;	/* may exceed "size" */
+};
+
+
+static void put(struct out *o, const char *s, size_t len)
+{
+	if (o->pos + 1 < o->size) {
+		size_t room = o->size - o->pos - 1;
+
+		memcpy(o->buf + o->pos, s, len < room ? len : room);
+	}
+	o->pos += len;
+}
+
+
+static void pad(struct out *o, char c, int n)
+{
+	while (n-- > 0) {
+		if (o->pos + 1 < o->size)
+			o->buf[o->pos] = c;
+		o->pos++;
+	}
+}
+
+
+static void emit_int(struct out *o, char conv, unsigned flags, int width,
+    int prec, uintmax_t v, bool neg)
+{
+	unsigned base = conv == 'o' ? 8 : conv == 'x' || conv == 'X' ? 16 : 10;
+	char buf[3 * sizeof(uintmax_t)];
+	char *p = buf;
+	char prefix[2];
+	int n_prefix = 0;
+	bool zero_pad = (flags & FORMAT_ZERO) && prec < 0;
+	int n, zeros;
+
+	if (!v && !prec) {
+		n = 0;
+	} else if (base == 10) {
+		n = fmtnum_u64(buf, v);
+	} else if (base == 16) {
+		n = fmtnum_hex(buf, v, conv == 'X');
+	} else {
+		p = buf + sizeof(buf);
+		do {
+			*--p = '0' + (v & 7);
+			v >>= 3;
+		} while (v);
+		n = buf + sizeof(buf) - p;
+	}
+
+	if (neg)
+		prefix[n_prefix++] = '-';
+	else if (conv == 'd' || conv == 'i') {
+		if (flags & FORMAT_PLUS)
+			prefix[n_prefix++] = '+';
+		else if (flags & FORMAT_SPACE)
+			prefix[n_prefix++] = ' ';
+	}
+	if (flags & FORMAT_ALT) {
+		if (conv == 'o' && (!n || *p != '0') && prec <= n)
+			prec = n + 1;
+		if (base == 16 && n && *p != '0') {
+			prefix[n_prefix++] = '0';
+			prefix[n_prefix++] = conv;
+		}
+	}
+
+	zeros = prec > n ? prec - n : 0;
+	width -= n_prefix + zeros + n;
+	if (!(flags & FORMAT_LEFT)) {
+		if (zero_pad && width > 0)
+			zeros += width;
+		else
+			pad(o, ' ', width);
+		width = 0;
+	}
+	put(o, prefix, n_prefix);
+	pad(o, '0', zeros);
+	put(o, p, n);
+	pad(o, ' ', width);
+}
+
+
+static void emit_str(struct out *o, unsigned flags, int width,
+    const char *s, size_t len)
+{
+	if (!(flags & FORMAT_LEFT))
+		pad(o, ' ', width - (int) len);
+	put(o, s, len);
+	if (flags & FORMAT_LEFT)
+		pad(o, ' ', width - (int) len);
+}
+
+
+static void append_number(char **p, int n)
+{
+	char buf[12];
+	char *q = buf + sizeof(buf);
+
+	do {
+		*--q = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	while (q != buf + sizeof(buf))
+		*(*p)++ = *q++;
+}
+
+
+/* pointers and floating-point numbers */
+
+static void emit_snprintf(struct out *o, const struct format_conv *c,
+    unsigned flags, int width, int prec, const union format_arg *arg)
+{
+	char spec[40];
+	char *p = spec;
+	size_t room = o->pos < o->size ? o->size - o->pos : 0;
+	char *buf = room ? o->buf + o->pos : NULL;
+	int len;
+
+	*p++ = '%';
+	if (flags & FORMAT_LEFT)
+		*p++ = '-';
+	if (flags & FORMAT_PLUS)
+		*p++ = '+';
+	if (flags & FORMAT_SPACE)
+		*p++ = ' ';
+	if (flags & FORMAT_ALT)
+		*p++ = '#';
+	if (flags & FORMAT_ZERO)
+		*p++ = '0';
+	if (width > 0)
+		append_number(&p, width);
+	if (prec >= 0) {
+		*p++ = '.';
+		append_number(&p, prec);
+	}
+	if (c->len == format_len_L)
+		*p++ = 'L';
+	*p++ = c->conv;
+	*p = 0;
+
+	if (c->conv == 'p')
+		len = snprintf(buf, room, spec, arg->p);
+	else if (c->len == format_len_L)
+		len = snprintf(buf, room, spec, arg->ld);
+	else
+		len = snprintf(buf, room, spec, arg->d);
+	if (len > 0)
+		o->pos += len;
+}
+
+
+/* %f without flags other than - */
+
+static void emit_fixed(struct out *o, const struct format_conv *c,
+    unsigned flags, int width, int prec, const union format_arg *arg)
+{
+	char buf[FMTNUM_DOUBLE_MAX];
+	size_t len;
+
+	len = fmtnum_fixed(buf, sizeof(buf), arg->d, prec < 0 ? 6 : prec);
+	if (len < sizeof(buf))
+		emit_str(o, flags, width, buf, len);
+	else
+		emit_snprintf(o, c, flags, width, prec, arg);
+}
+
+
+/* ----- Rendering --------------------------------------------------------- */
+
+
+size_t format_render_args(const struct format *f, char *buf, size_t size,
+    const union format_arg *args)
+{
+	struct out o = {
+		.buf	= buf,
+		.size	= size,
+		.pos	= 0,
+	};
+	const struct format_conv *c;
+
+	for (c = f->conv; ; c++) {
+		unsigned flags = c->flags;
+		int width = c->width;
+		int prec = c->prec;
+		const char *s;
+
+		put(&o, f->text + c->lit, c->lit_len);
+		if (!c->conv)
+			break;
+		if (width == FORMAT_STAR) {
+			width = args++->i;
+			if (width < 0) {
+				flags |= FORMAT_LEFT;
+				width = -width;
+			}
+		}
+		if (prec == FORMAT_STAR) {
+			prec = args++->i;
+			if (prec < 0)
+				prec = -1;
+		}
+		switch (c->conv) {
+		case 'd':
+		case 'i':
+			emit_int(&o, c->conv, flags, width, prec,
+			    args->i < 0 ? -(uintmax_t) args->i :
+			    (uintmax_t) args->i, args->i < 0);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			emit_int(&o, c->conv, flags, width, prec, args->u, 0);
+			break;
+		case 'c':
+			emit_str(&o, flags, width, &(char) { args->i }, 1);
+			break;
+		case 's':
+			s = args->s;
+			/* like glibc */
+			if (!s)
+				s = prec < 0 || prec >= 6 ? "(null)" : "";
+			emit_str(&o, flags, width, s,
+			    prec < 0 ? strlen(s) : strnlen(s, prec));
+			break;
+		case 'f':
+			if (!(flags & ~FORMAT_LEFT) &&
+			    c->len != format_len_L) {
+				emit_fixed(&o, c, flags, width, prec, args);
+				break;
+			}
+			/* fall through */
+		default:
+			emit_snprintf(&o, c, flags, width, prec, args);
+			break;
+		}
+		args++;
+	}
+	if (size)
+		buf[o.pos < size ? o.pos : size - 1] = 0;
+	return o.pos;
+}
+
+
+size_t format_vrender(const struct format *f, char *buf, size_t size,
+    va_list ap)
+{
+	union format_arg args[f->n_args + 1];
+
+	format_capture(f, args, ap);
+	return format_render_args(f, buf, size, args);
+}
+
+
+size_t format_render(const struct format *f, char *buf, size_t size, ...)
+{
+	va_list ap;
+	size_t len;
+
+	va_start(ap, size);
+	len = format_vrender(f, buf, size, ap);
+	va_end(ap);
+	return len;
 }
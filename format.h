@@ -1,7 +1,7 @@
 /*
- * format.h - Check if printf-style format string matches pattern
+ * format.h - Check and compile printf-style format strings
  *
- * Copyright (C) 2021 Linzhi Ltd.
+ * Copyright (C) 2021, 2023 Linzhi Ltd.
  *
  * This work is licensed under the terms of the MIT License.
  * A copy of the license can be found in the file COPYING.txt
@@ -10,16 +10,125 @@
 #ifndef LINZHI_LIBCOMMON_FORMAT_H
 #define	LINZHI_LIBCOMMON_FORMAT_H
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* struct format_conv flags */
+
+#define	FORMAT_LEFT	1	/* - */
+#define	FORMAT_PLUS	2	/* + */
+#define	FORMAT_SPACE	4	/* space */
+#define	FORMAT_ALT	8	/* # */
+#define	FORMAT_ZERO	16	/* 0 */
+
+/* width or precision given by an argument */
+
+#define	FORMAT_STAR	-2
+
+
+enum format_len {
+	format_len_none,
+	format_len_hh,
+	format_len_h,
+	format_len_l,
+	format_len_ll,
+	format_len_j,
+	format_len_z,
+	format_len_t,
+	format_len_L,
+};
+
+/*
+ * Each conversion is preceded by a literal, at "lit" in the text of the
+ * format. The last entry has conv == 0 and holds only the literal after the
+ * last conversion.
+ */
+
+struct format_conv {
+	unsigned	lit;
+	unsigned	lit_len;
+	char		conv;		/* d, u, x, f, s, etc. */
+	enum format_len	len;
+	unsigned	flags;
+	int		width;		/* -1 if absent */
+	int		prec;		/* -1 if absent */
+};
+
+struct format {
+	const char		*text;	/* literals, with %% turned into % */
+	const char		*sig;	/* field signature */
+	unsigned		n_args;
+	unsigned		n;	/* conversions, plus the end */
+	struct format_conv	conv[];
+};
+
+/* one per argument, including * widths and precisions */
+
+union format_arg {
+	intmax_t	i;	/* d, i, c, and * */
+	uintmax_t	u;	/* u, o, x, X */
+	double		d;
+	long double	ld;	/* with L */
+	const char	*s;
+	const void	*p;
+};
 
 
 /*
  * "fmt" is a printf-style format string. "fields" is a string of field types,
- * with one letter per fields. The following field types are recognized: d, u,
- * c, s, and p. Additionally, * is recognized as representing a * in a format
- * specification. E.g., format "%*.s" would yield true for fields "*s".
+ * with one letter per field:
+ *
+ * d	d, i
+ * u	u, o, x, X
+ * c	c
+ * s	s
+ * p	p
+ * f	f, F, e, E, g, G, a, A
+ *
+ * The letter is preceded by the length modifier, if any, e.g., "%lld" is
+ * "lld", "%zx" is "zu", and "%Lg" is "Lf". "%lf" is the same as "%f". A * in
+ * the format is represented by a *. E.g., format "%*.s" would yield true for
+ * fields "*s".
+ *
+ * %n, positional arguments, and wide characters are not supported. Flags,
+ * width, and precision before a literal %, e.g., "%5%", are accepted and have
+ * no effect, as in printf. A * there still expects a * field.
  */
 
 bool format_compatible(const char *fmt, const char *fields);
 
+/*
+ * format_compile parses the format once, for repeated rendering. It returns
+ * NULL if format_compatible would reject the format for all fields, and also
+ * for a * before a literal %, e.g., "%*%".
+ */
+
+struct format *format_compile(const char *fmt);
+void format_free(struct format *f);
+
+bool format_check(const struct format *f, const char *fields);
+
+/*
+ * The rendering functions behave like snprintf: they return the length of the
+ * complete output, and write at most "size" bytes, including the terminating
+ * NUL.
+ */
+
+size_t format_render(const struct format *f, char *buf, size_t size, ...);
+size_t format_vrender(const struct format *f, char *buf, size_t size,
+    va_list ap);
+
+/*
+ * For deferred rendering, format_capture stores the arguments in "args", which
+ * has room for f->n_args entries.
+ */
+
+void format_capture(const struct format *f, union format_arg *args,
+    va_list ap);
+size_t format_render_args(const struct format *f, char *buf, size_t size,
+    const union format_arg *args);
+
 #endif /* !LINZHI_LIBCOMMON_FORMAT_H */
@@ -0,0 +1,207 @@
+/*
+ * hist.c - Log-linear latency histograms
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+#include "dtime.h"
+#include "hist.h"
+
+
+#define	SUB		(1 << HIST_SUB_BITS)
+#define	MAX_VALUE	((1ull << HIST_MAX_BITS) - 1)
+
+
+struct hist_shard {
+	atomic_uint_least64_t	count[HIST_BUCKETS];
+	atomic_uint_least64_t	sum;
+	atomic_uint_least64_t	max;
+} __attribute__((aligned(64)));
+
+struct hist {
+	struct hist_shard	shard[HIST_SHARDS];
+};
+
+
+static atomic_uint next_shard = 0;
+static __thread unsigned my_shard = UINT_MAX;
+
+
+/* ----- Bucket mapping ---------------------------------------------------- */
+
+
+static unsigned bucket(uint64_t v)
+{
+	unsigned shift;
+
+	if (v < 2 * SUB)
+		return v;
+	if (v > MAX_VALUE)
+		v = MAX_VALUE;
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + (v >> shift) - SUB;
+}
+
+
+/* highest value that falls into bucket "i" */
+
+static uint64_t bucket_top(unsigned i)
+{
+	unsigned shift;
+
+	if (i < 2 * SUB)
+		return i;
+	shift = (i >> HIST_SUB_BITS) - 1;
+	return ((uint64_t) ((i & (SUB - 1)) + SUB + 1) << shift) - 1;
+}
+
+
+/* ----- Recording --------------------------------------------------------- */
+
+
+struct hist *hist_new(void)
+{
+	struct hist *h;
+
+	h = aligned_alloc(64, sizeof(struct hist));
+	if (!h) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	memset(h, 0, sizeof(*h));
+	return h;
+}
+
+
+void hist_free(struct hist *h)
+{
+	free(h);
+}
+
+
+void hist_record_ns(struct hist *h, uint64_t ns)
+{
+	struct hist_shard *shard;
+	uint64_t max;
+
+	if (my_shard == UINT_MAX)
+		my_shard = atomic_fetch_add_explicit(&next_shard, 1,
+		    memory_order_relaxed) % HIST_SHARDS;
+	shard = h->shard + my_shard;
+	atomic_fetch_add_explicit(shard->count + bucket(ns), 1,
+	    memory_order_relaxed);
+	atomic_fetch_add_explicit(&shard->sum, ns, memory_order_relaxed);
+	max = atomic_load_explicit(&shard->max, memory_order_relaxed);
+	while (ns > max && !atomic_compare_exchange_weak_explicit(&shard->max,
+	    &max, ns, memory_order_relaxed, memory_order_relaxed));
+}
+
+
+/* ----- Reading ----------------------------------------------------------- */
+
+
+static uint64_t get(atomic_uint_least64_t *p, bool reset)
+{
+	return reset ? atomic_exchange_explicit(p, 0, memory_order_relaxed) :
+	    atomic_load_explicit(p, memory_order_relaxed);
+}
+
+
+void hist_snapshot(struct hist *h, struct hist_snapshot *s, bool reset)
+{
+	unsigned i, j;
+
+	memset(s, 0, sizeof(*s));
+	for (i = 0; i != HIST_SHARDS; i++) {
+		struct hist_shard *shard = h->shard + i;
+		uint64_t max;
+
+		for (j = 0; j != HIST_BUCKETS; j++) {
+			uint64_t n = get(shard->count + j, reset);
+
+			s->count[j] += n;
+			s->n += n;
+		}
+		s->sum += get(&shard->sum, reset);
+		max = get(&shard->max, reset);
+		if (max > s->max)
+			s->max = max;
+	}
+}
+
+
+uint64_t hist_percentile(const struct hist_snapshot *s, double p)
+{
+	uint64_t rank, seen = 0;
+	unsigned i;
+
+	if (!s->n)
+		return 0;
+	/* nearest rank, clamped to [1, n] */
+	if (p >= 100)
+		rank = s->n;
+	else
+		rank = p > 0 ? ceil(s->n * p / 100.0) : 1;
+	if (!rank)
+		rank = 1;
+	if (rank > s->n)
+		rank = s->n;
+	for (i = 0; i != HIST_BUCKETS; i++) {
+		seen += s->count[i];
+		if (seen >= rank)
+			break;
+	}
+	/* the top of the bucket may exceed the largest value recorded */
+	return bucket_top(i) < s->max ? bucket_top(i) : s->max;
+}
+
+
+double hist_mean(const struct hist_snapshot *s)
+{
+	return s->n ? (double) s->sum / s->n : 0;
+}
+
+
+/* ----- Timing ------------------------------------------------------------ */
+
+
+uint64_t hist_start(void)
+{
+	return dtime_clock_ns();
+}
+
+
+void hist_stop(struct hist *h, uint64_t t0)
+{
+	hist_record_ns(h, hist_start() - t0);
+}
+
+
+struct hist_scope hist_scope_begin(struct hist *h)
+{
+	struct hist_scope scope = {
+		.hist	= h,
+		.t0	= hist_start(),
+	};
+
+	return scope;
+}
+
+
+void hist_scope_end(struct hist_scope *scope)
+{
+	hist_stop(scope->hist, scope->t0);
+}
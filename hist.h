@@ -0,0 +1,84 @@
+/*
+ * hist.h - Log-linear latency histograms
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Values are nanoseconds. Each power of two is divided into 32 buckets, so the
+ * relative error of a percentile is at most about 3 %. Values from 2^40 ns
+ * (about 18 minutes) on are counted in the highest bucket.
+ *
+ * Recording is a few atomic increments on one of several shards, picked per
+ * thread, so that threads rarely share cache lines. Reading merges the shards.
+ */
+
+#ifndef LINZHI_LIBCOMMON_HIST_H
+#define	LINZHI_LIBCOMMON_HIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define	HIST_SUB_BITS	5
+#define	HIST_MAX_BITS	40
+#define	HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define	HIST_SHARDS	4
+
+
+struct hist;
+
+struct hist_snapshot {
+	uint64_t	n;
+	uint64_t	sum;
+	uint64_t	max;
+	uint64_t	count[HIST_BUCKETS];
+};
+
+struct hist_scope {
+	struct hist	*hist;
+	uint64_t	t0;
+};
+
+
+struct hist *hist_new(void);
+void hist_free(struct hist *h);
+
+void hist_record_ns(struct hist *h, uint64_t ns);
+
+/* merge all shards into "s" and, if "reset" is set, clear the histogram */
+
+void hist_snapshot(struct hist *h, struct hist_snapshot *s, bool reset);
+
+/* "p" is in percent, e.g., 99.9 */
+
+uint64_t hist_percentile(const struct hist_snapshot *s, double p);
+double hist_mean(const struct hist_snapshot *s);
+
+/*
+ * Time a region:
+ *
+ * t0 = hist_start();
+ * ...
+ * hist_stop(h, t0);
+ *
+ * or, for the rest of the enclosing block, hist_scope(h);
+ */
+
+uint64_t hist_start(void);
+void hist_stop(struct hist *h, uint64_t t0);
+
+struct hist_scope hist_scope_begin(struct hist *h);
+void hist_scope_end(struct hist_scope *scope);
+
+#define	HIST_CONCAT_(a, b)	a##b
+#define	HIST_CONCAT(a, b)	HIST_CONCAT_(a, b)
+
+#define	hist_scope(h)							\
+    struct hist_scope HIST_CONCAT(hist_scope_, __COUNTER__)		\
+	__attribute__((cleanup(hist_scope_end))) = hist_scope_begin(h)
+
+#endif /* !LINZHI_LIBCOMMON_HIST_H */
@@ -0,0 +1,405 @@
+/*
+ * htable.c - Intrusive open-addressing hash tables
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "thread.h"
+#include "htable.h"
+
+
+#define	MIN_SIZE	16
+#define	MIGRATE		16	/* old slots moved per add or delete */
+
+#define	DELETED		(&deleted)
+
+
+struct htable_slot {
+	uint64_t		hash;
+	struct htable_node	*node;	/* NULL if never used */
+};
+
+
+static struct htable_node deleted;
+
+
+/* ----- Hash functions ---------------------------------------------------- */
+
+
+#define	K1	0x9e3779b97f4a7c15ull
+#define	K2	0xc2b2ae3d27d4eb4full
+
+
+static inline uint64_t mix(uint64_t h, uint64_t w)
+{
+	h ^= w * K2;
+	return ((h << 31) | (h >> 33)) * K1;
+}
+
+
+/* MurmurHash3 finalizer */
+
+static inline uint64_t fmix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+uint64_t hash_mem(const void *p, size_t len)
+{
+	const uint8_t *s = p;
+	uint64_t h = len * K1;
+	uint64_t w;
+
+	while (len >= 8) {
+		memcpy(&w, s, 8);
+		h = mix(h, w);
+		s += 8;
+		len -= 8;
+	}
+	if (len) {
+		w = 0;
+		memcpy(&w, s, len);
+		h = mix(h, w);
+	}
+	return fmix64(h);
+}
+
+
+uint64_t hash_str(const char *s)
+{
+	return hash_mem(s, strlen(s));
+}
+
+
+/* ----- Slot arrays ------------------------------------------------------- */
+
+
+static struct htable_slot *slots_new(size_t size)
+{
+	struct htable_slot *slots;
+
+	slots = calloc(size, sizeof(struct htable_slot));
+	if (!slots) {
+		perror("calloc");
+		exit(1);
+	}
+	return slots;
+}
+
+
+/* returns true if the node went into a slot that had never been used */
+
+static bool slots_insert(struct htable_slot *slots, size_t size,
+    struct htable_node *node)
+{
+	size_t mask = size - 1;
+	size_t i;
+
+	for (i = node->hash & mask; slots[i].node && slots[i].node != DELETED;
+	    i = (i + 1) & mask);
+	slots[i].hash = node->hash;
+	if (slots[i].node) {
+		slots[i].node = node;
+		return 0;
+	}
+	slots[i].node = node;
+	return 1;
+}
+
+
+static struct htable_node *slots_find(const struct htable_slot *slots,
+    size_t size, uint64_t hash, const void *key,
+    bool (*eq)(const struct htable_node *node, const void *key))
+{
+	size_t mask = size - 1;
+	size_t i;
+
+	for (i = hash & mask; slots[i].node; i = (i + 1) & mask)
+		if (slots[i].hash == hash && slots[i].node != DELETED &&
+		    eq(slots[i].node, key))
+			return slots[i].node;
+	return NULL;
+}
+
+
+static struct htable_slot *slots_find_node(struct htable_slot *slots,
+    size_t size, const struct htable_node *node)
+{
+	size_t mask = size - 1;
+	size_t i;
+
+	for (i = node->hash & mask; slots[i].node; i = (i + 1) & mask)
+		if (slots[i].node == node)
+			return slots + i;
+	return NULL;
+}
+
+
+/* ----- Incremental resizing ---------------------------------------------- */
+
+
+static void migrate(struct htable *t, size_t max)
+{
+	struct htable_slot *slot;
+
+	if (!t->old)
+		return;
+	while (max-- && t->old_pos != t->old_size) {
+		slot = t->old + t->old_pos++;
+		if (slot->node && slot->node != DELETED) {
+			t->used += slots_insert(t->slots, t->size, slot->node);
+			/* keep the probe chains of the old array intact */
+			slot->node = DELETED;
+		}
+	}
+	if (t->old_pos == t->old_size) {
+		free(t->old);
+		t->old = NULL;
+	}
+}
+
+
+/*
+ * Called when "slots" is three quarters full of live and deleted entries. If
+ * at most half of it are live, we only get rid of the deleted entries.
+ */
+
+static void resize(struct htable *t)
+{
+	size_t size;
+
+	/* rare: the new array filled up before the old one was emptied */
+	migrate(t, SIZE_MAX);
+
+	if (!t->size)
+		size = MIN_SIZE;
+	else if (2 * (t->n + 1) > t->size)
+		size = 2 * t->size;
+	else
+		size = t->size;
+
+	t->old = t->slots;
+	t->old_size = t->size;
+	t->old_pos = 0;
+	t->slots = slots_new(size);
+	t->size = size;
+	t->used = 0;
+	migrate(t, MIGRATE);
+}
+
+
+/* ----- Single-threaded table --------------------------------------------- */
+
+
+void htable_init(struct htable *t,
+    bool (*eq)(const struct htable_node *node, const void *key))
+{
+	t->slots = NULL;
+	t->size = 0;
+	t->n = 0;
+	t->used = 0;
+	t->old = NULL;
+	t->old_size = 0;
+	t->old_pos = 0;
+	t->eq = eq;
+}
+
+
+void htable_destroy(struct htable *t)
+{
+	free(t->slots);
+	free(t->old);
+}
+
+
+void htable_add(struct htable *t, struct htable_node *node, uint64_t hash)
+{
+	migrate(t, MIGRATE);
+	if (4 * (t->used + 1) > 3 * t->size)
+		resize(t);
+	node->hash = hash;
+	t->used += slots_insert(t->slots, t->size, node);
+	t->n++;
+}
+
+
+struct htable_node *htable_find(const struct htable *t, uint64_t hash,
+    const void *key)
+{
+	struct htable_node *node = NULL;
+
+	if (t->size)
+		node = slots_find(t->slots, t->size, hash, key, t->eq);
+	if (!node && t->old)
+		node = slots_find(t->old, t->old_size, hash, key, t->eq);
+	return node;
+}
+
+
+bool htable_del(struct htable *t, struct htable_node *node)
+{
+	struct htable_slot *slot;
+
+	migrate(t, MIGRATE);
+	if (!t->size)
+		return 0;
+	slot = slots_find_node(t->slots, t->size, node);
+	if (slot) {
+		/* no probe continues past a slot followed by an unused one */
+		if (!t->slots[(slot - t->slots + 1) & (t->size - 1)].node) {
+			slot->node = NULL;
+			t->used--;
+		} else {
+			slot->node = DELETED;
+		}
+	} else {
+		if (!t->old)
+			return 0;
+		slot = slots_find_node(t->old, t->old_size, node);
+		if (!slot)
+			return 0;
+		slot->node = DELETED;
+	}
+	t->n--;
+	return 1;
+}
+
+
+struct htable_node *htable_next(const struct htable *t, size_t *pos)
+{
+	const struct htable_slot *slot;
+
+	while (*pos != t->size + (t->old ? t->old_size : 0)) {
+		if (*pos < t->size)
+			slot = t->slots + *pos;
+		else
+			slot = t->old + *pos - t->size;
+		++*pos;
+		if (slot->node && slot->node != DELETED)
+			return slot->node;
+	}
+	return NULL;
+}
+
+
+/* ----- Sharded thread-safe table ----------------------------------------- */
+
+
+static struct htable_shard *shard_of(struct htable_sharded *t, uint64_t hash)
+{
+	/* the tables index by the low bits */
+	return t->shard + (hash >> (64 - HTABLE_SHARD_BITS));
+}
+
+
+void htable_sharded_init(struct htable_sharded *t,
+    bool (*eq)(const struct htable_node *node, const void *key))
+{
+	unsigned i;
+
+	for (i = 0; i != HTABLE_SHARDS; i++) {
+		pthread_rwlock_init(&t->shard[i].rwlock, NULL);
+		htable_init(&t->shard[i].table, eq);
+	}
+}
+
+
+void htable_sharded_destroy(struct htable_sharded *t)
+{
+	unsigned i;
+
+	for (i = 0; i != HTABLE_SHARDS; i++) {
+		rwlock_destroy(&t->shard[i].rwlock);
+		htable_destroy(&t->shard[i].table);
+	}
+}
+
+
+void htable_sharded_add(struct htable_sharded *t, struct htable_node *node,
+    uint64_t hash)
+{
+	struct htable_shard *shard = shard_of(t, hash);
+
+	wrlock(&shard->rwlock);
+	htable_add(&shard->table, node, hash);
+	rwunlock(&shard->rwlock);
+}
+
+
+struct htable_node *htable_sharded_find(struct htable_sharded *t,
+    uint64_t hash, const void *key)
+{
+	struct htable_shard *shard = shard_of(t, hash);
+	struct htable_node *node;
+
+	rdlock(&shard->rwlock);
+	node = htable_find(&shard->table, hash, key);
+	rwunlock(&shard->rwlock);
+	return node;
+}
+
+
+bool htable_sharded_del(struct htable_sharded *t, struct htable_node *node)
+{
+	struct htable_shard *shard = shard_of(t, node->hash);
+	bool found;
+
+	wrlock(&shard->rwlock);
+	found = htable_del(&shard->table, node);
+	rwunlock(&shard->rwlock);
+	return found;
+}
+
+
+struct htable_node *htable_sharded_find_or_add(struct htable_sharded *t,
+    uint64_t hash, const void *key,
+    struct htable_node *(*make)(void *user, const void *key), void *user)
+{
+	struct htable_shard *shard = shard_of(t, hash);
+	struct htable_node *node;
+
+	/* the common case is that the node exists */
+	node = htable_sharded_find(t, hash, key);
+	if (node)
+		return node;
+
+	wrlock(&shard->rwlock);
+	node = htable_find(&shard->table, hash, key);
+	if (!node) {
+		node = make(user, key);
+		htable_add(&shard->table, node, hash);
+	}
+	rwunlock(&shard->rwlock);
+	return node;
+}
+
+
+size_t htable_sharded_count(struct htable_sharded *t)
+{
+	size_t n = 0;
+	unsigned i;
+
+	for (i = 0; i != HTABLE_SHARDS; i++) {
+		rdlock(&t->shard[i].rwlock);
+		n += htable_count(&t->shard[i].table);
+		rwunlock(&t->shard[i].rwlock);
+	}
+	return n;
+}
@@ -0,0 +1,142 @@
+/*
+ * htable.h - Intrusive open-addressing hash tables
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * struct htable_node is embedded in the elements. The table is an array of
+ * slots, each holding the hash and a pointer to the node, so that probing
+ * only dereferences nodes whose hash matches. Probing is linear.
+ *
+ * When the table grows, the old array is kept, and each subsequent add or
+ * delete moves a few of its slots to the new one. Lookups check both arrays.
+ * This way, no single operation has to rehash the whole table.
+ *
+ * struct htable is not thread-safe. struct htable_sharded splits the keys
+ * over several tables, each protected by a reader-writer lock.
+ */
+
+#ifndef LINZHI_LIBCOMMON_HTABLE_H
+#define	LINZHI_LIBCOMMON_HTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+#define	HTABLE_SHARD_BITS	4
+#define	HTABLE_SHARDS		(1 << HTABLE_SHARD_BITS)
+
+
+struct htable_node {
+	uint64_t	hash;
+};
+
+struct htable_slot;
+
+/*
+ * "eq" returns whether "node" has the key "key". It is only called for nodes
+ * with the same hash as the key.
+ */
+
+struct htable {
+	struct htable_slot	*slots;
+	size_t			size;	/* power of two, or zero */
+	size_t			n;	/* live nodes, in both arrays */
+	size_t			used;	/* live and deleted slots in "slots" */
+	struct htable_slot	*old;	/* being moved to "slots" */
+	size_t			old_size;
+	size_t			old_pos;
+	bool (*eq)(const struct htable_node *node, const void *key);
+};
+
+struct htable_sharded {
+	struct htable_shard {
+		pthread_rwlock_t	rwlock;
+		struct htable		table;
+	} __attribute__((aligned(64))) shard[HTABLE_SHARDS];
+};
+
+
+/* ----- Hash functions ---------------------------------------------------- */
+
+
+uint64_t hash_mem(const void *p, size_t len);
+uint64_t hash_str(const char *s);
+
+
+/* ----- Single-threaded table --------------------------------------------- */
+
+
+void htable_init(struct htable *t,
+    bool (*eq)(const struct htable_node *node, const void *key));
+
+/* htable_destroy only frees the table; the nodes belong to the caller */
+
+void htable_destroy(struct htable *t);
+
+/* htable_add does not check for duplicates */
+
+void htable_add(struct htable *t, struct htable_node *node, uint64_t hash);
+struct htable_node *htable_find(const struct htable *t, uint64_t hash,
+    const void *key);
+
+/* returns false if "node" is not in the table */
+
+bool htable_del(struct htable *t, struct htable_node *node);
+
+static inline size_t htable_count(const struct htable *t)
+{
+	return t->n;
+}
+
+/*
+ * Iterate over all nodes, in no particular order, with
+ *
+ * size_t pos = 0;
+ *
+ * while ((node = htable_next(t, &pos)))
+ *	...
+ *
+ * The table must not change during the iteration.
+ */
+
+struct htable_node *htable_next(const struct htable *t, size_t *pos);
+
+
+/* ----- Sharded thread-safe table ----------------------------------------- */
+
+
+void htable_sharded_init(struct htable_sharded *t,
+    bool (*eq)(const struct htable_node *node, const void *key));
+void htable_sharded_destroy(struct htable_sharded *t);
+
+void htable_sharded_add(struct htable_sharded *t, struct htable_node *node,
+    uint64_t hash);
+
+/*
+ * The caller has to ensure that the node returned by htable_sharded_find is
+ * not deleted and freed while it is still in use.
+ */
+
+struct htable_node *htable_sharded_find(struct htable_sharded *t,
+    uint64_t hash, const void *key);
+bool htable_sharded_del(struct htable_sharded *t, struct htable_node *node);
+
+/*
+ * Find the node or, if there is none, add the one returned by "make". "make"
+ * runs with the shard locked and must not access the table.
+ */
+
+struct htable_node *htable_sharded_find_or_add(struct htable_sharded *t,
+    uint64_t hash, const void *key,
+    struct htable_node *(*make)(void *user, const void *key), void *user);
+
+size_t htable_sharded_count(struct htable_sharded *t);
+
+#endif /* !LINZHI_LIBCOMMON_HTABLE_H */
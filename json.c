@@ -0,0 +1,271 @@
+/*
+ * json.c - Streaming JSON writer
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "sb.h"
+#include "mqtt.h"
+#include "json.h"
+
+
+/* ----- Setup ------------------------------------------------------------- */
+
+
+void json_init(struct json *j)
+{
+	sb_init(&j->sb);
+	json_reset(j);
+}
+
+
+void json_free(struct json *j)
+{
+	sb_free(&j->sb);
+}
+
+
+void json_reset(struct json *j)
+{
+	sb_reset(&j->sb);
+	j->objects = 0;
+	j->depth = 0;
+	j->first = 1;
+	j->key = 0;
+}
+
+
+/* ----- Structure --------------------------------------------------------- */
+
+
+static bool in_object(const struct json *j)
+{
+	return j->depth && ((j->objects >> (j->depth - 1)) & 1);
+}
+
+
+static void before_value(struct json *j)
+{
+	if (!j->depth) {
+		/* only one value at the top level */
+		assert(j->first);
+		j->first = 0;
+		return;
+	}
+	if (in_object(j)) {
+		assert(j->key);
+		j->key = 0;
+		return;
+	}
+	if (!j->first)
+		sb_append_c(&j->sb, ',');
+	j->first = 0;
+}
+
+
+static void begin(struct json *j, bool object)
+{
+	before_value(j);
+	assert(j->depth < JSON_MAX_DEPTH);
+	if (object)
+		j->objects |= (uint64_t) 1 << j->depth;
+	else
+		j->objects &= ~((uint64_t) 1 << j->depth);
+	j->depth++;
+	j->first = 1;
+	sb_append_c(&j->sb, object ? '{' : '[');
+}
+
+
+static void end(struct json *j, bool object)
+{
+	assert(j->depth && in_object(j) == object && !j->key);
+	j->depth--;
+	j->first = 0;
+	sb_append_c(&j->sb, object ? '}' : ']');
+}
+
+
+void json_begin_object(struct json *j)
+{
+	begin(j, 1);
+}
+
+
+void json_end_object(struct json *j)
+{
+	end(j, 1);
+}
+
+
+void json_begin_array(struct json *j)
+{
+	begin(j, 0);
+}
+
+
+void json_end_array(struct json *j)
+{
+	end(j, 0);
+}
+
+
+/* ----- Strings ----------------------------------------------------------- */
+
+
+static void escaped(struct sb *sb, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = s + len;
+	const char *run;
+	char esc[6] = "\\u00";
+	unsigned char c;
+
+	sb_reserve(sb, len + 2);
+	sb->buf[sb->len++] = '"';
+	while (s != end) {
+		for (run = s; s != end; s++) {
+			c = *s;
+			if (c < 0x20 || c == '"' || c == '\\')
+				break;
+		}
+		sb_append_n(sb, run, s - run);
+		if (s == end)
+			break;
+		c = *s++;
+		switch (c) {
+		case '"':
+		case '\\':
+			esc[1] = c;
+			break;
+		case '\b':
+			esc[1] = 'b';
+			break;
+		case '\f':
+			esc[1] = 'f';
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			esc[1] = 'u';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			sb_append_n(sb, esc, 6);
+			continue;
+		}
+		sb_append_n(sb, esc, 2);
+	}
+	sb_append_c(sb, '"');
+}
+
+
+void json_key(struct json *j, const char *key)
+{
+	assert(in_object(j) && !j->key);
+	if (!j->first)
+		sb_append_c(&j->sb, ',');
+	j->first = 0;
+	escaped(&j->sb, key, strlen(key));
+	sb_append_c(&j->sb, ':');
+	j->key = 1;
+}
+
+
+void json_string_n(struct json *j, const char *s, size_t len)
+{
+	before_value(j);
+	escaped(&j->sb, s, len);
+}
+
+
+void json_string(struct json *j, const char *s)
+{
+	json_string_n(j, s, strlen(s));
+}
+
+
+/* ----- Other values ------------------------------------------------------ */
+
+
+void json_u64(struct json *j, uint64_t v)
+{
+	before_value(j);
+	sb_append_u64(&j->sb, v);
+}
+
+
+void json_i64(struct json *j, int64_t v)
+{
+	before_value(j);
+	sb_append_i64(&j->sb, v);
+}
+
+
+void json_double(struct json *j, double v, int prec)
+{
+	before_value(j);
+	if (isfinite(v))
+		sb_append_double(&j->sb, v, prec);
+	else
+		sb_append_n(&j->sb, "null", 4);
+}
+
+
+void json_bool(struct json *j, bool v)
+{
+	before_value(j);
+	if (v)
+		sb_append_n(&j->sb, "true", 4);
+	else
+		sb_append_n(&j->sb, "false", 5);
+}
+
+
+void json_null(struct json *j)
+{
+	before_value(j);
+	sb_append_n(&j->sb, "null", 4);
+}
+
+
+/* ----- Output ------------------------------------------------------------ */
+
+
+const char *json_str(const struct json *j)
+{
+	assert(!j->depth && !j->first);
+	return sb_str(&j->sb);
+}
+
+
+void json_publish(struct json *j, const char *topic, enum mqtt_qos qos,
+    bool retain)
+{
+	mqtt_publish(topic, qos, retain, json_str(j), j->sb.len);
+	json_reset(j);
+}
+
+
+void json_publish_topic(struct json *j, const struct topic *topic,
+    enum mqtt_qos qos, bool retain)
+{
+	mqtt_publish_topic(topic, qos, retain, json_str(j), j->sb.len);
+	json_reset(j);
+}
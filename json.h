@@ -0,0 +1,100 @@
+/*
+ * json.h - Streaming JSON writer
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * The writer appends to a struct sb, and keeps track of the nesting in a bit
+ * mask, so writing a field allocates nothing (once the buffer has grown to
+ * its final size). Commas and colons are inserted automatically. E.g.,
+ *
+ * json_begin_object(&j);
+ * json_key(&j, "temp");
+ * json_double(&j, 71.5, 1);
+ * json_key(&j, "fans");
+ * json_begin_array(&j);
+ * json_u64(&j, 3200);
+ * json_u64(&j, 3150);
+ * json_end_array(&j);
+ * json_end_object(&j);
+ * json_publish(&j, "/status", qos_ack, 0);
+ *
+ * yields {"temp":71.5,"fans":[3200,3150]}.
+ *
+ * Keys and strings are escaped as needed, and must be UTF-8. Calls that would
+ * produce invalid JSON, e.g., a value in an object without a key, are caught
+ * by assertions.
+ */
+
+#ifndef LINZHI_LIBCOMMON_JSON_H
+#define	LINZHI_LIBCOMMON_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sb.h"
+#include "mqtt.h"
+
+
+#define	JSON_MAX_DEPTH	64
+
+
+struct topic;
+
+struct json {
+	struct sb	sb;
+	uint64_t	objects;	/* bit n set if level n is an object */
+	unsigned	depth;
+	bool		first;		/* nothing yet at this level */
+	bool		key;		/* key written, value expected */
+};
+
+
+void json_init(struct json *j);
+void json_free(struct json *j);
+
+/* start over, but keep the buffer */
+
+void json_reset(struct json *j);
+
+void json_begin_object(struct json *j);
+void json_end_object(struct json *j);
+void json_begin_array(struct json *j);
+void json_end_array(struct json *j);
+
+void json_key(struct json *j, const char *key);
+
+void json_string(struct json *j, const char *s);
+void json_string_n(struct json *j, const char *s, size_t len);
+void json_u64(struct json *j, uint64_t v);
+void json_i64(struct json *j, int64_t v);
+
+/*
+ * As for sb_append_double, prec < 0 selects the shortest representation. NaN
+ * and infinity, which JSON cannot represent, are written as null.
+ */
+
+void json_double(struct json *j, double v, int prec);
+void json_bool(struct json *j, bool v);
+void json_null(struct json *j);
+
+/* the complete document */
+
+const char *json_str(const struct json *j);
+
+/*
+ * Publish the complete document with mqtt_publish, and reset the writer for
+ * the next one.
+ */
+
+void json_publish(struct json *j, const char *topic, enum mqtt_qos qos,
+    bool retain);
+void json_publish_topic(struct json *j, const struct topic *topic,
+    enum mqtt_qos qos, bool retain);
+
+#endif /* !LINZHI_LIBCOMMON_JSON_H */
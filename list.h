@@ -0,0 +1,229 @@
+/*
+ * list.h - Intrusive doubly linked lists, in the style of the Linux kernel
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * struct list_head is embedded in the list elements, and also serves as the
+ * head of a circular list. struct hlist_head is a single pointer, for hash
+ * buckets and other places where the head should be small. Both allow O(1)
+ * removal of an element without knowing the list it is on.
+ */
+
+#ifndef LINZHI_LIBCOMMON_LIST_H
+#define	LINZHI_LIBCOMMON_LIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "container.h"
+
+
+/* ----- Doubly linked list ------------------------------------------------ */
+
+
+struct list_head {
+	struct list_head *next;
+	struct list_head *prev;
+};
+
+
+#define	LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define	LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+    struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+
+/* add after "head", e.g., for a stack */
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+
+/* add before "head", e.g., for a queue */
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = entry->prev = NULL;
+}
+
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD(entry);
+}
+
+
+static inline void list_move(struct list_head *entry, struct list_head *head)
+{
+	list_del(entry);
+	list_add(entry, head);
+}
+
+
+static inline void list_move_tail(struct list_head *entry,
+    struct list_head *head)
+{
+	list_del(entry);
+	list_add_tail(entry, head);
+}
+
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+
+/* move all entries of "list" to the beginning of "head", and empty "list" */
+
+static inline void list_splice_init(struct list_head *list,
+    struct list_head *head)
+{
+	if (list_empty(list))
+		return;
+	list->next->prev = head;
+	list->prev->next = head->next;
+	head->next->prev = list->prev;
+	head->next = list->next;
+	INIT_LIST_HEAD(list);
+}
+
+
+#define	list_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define	list_first_entry(head, type, member) \
+    list_entry((head)->next, type, member)
+
+#define	list_next_entry(pos, member) \
+    list_entry((pos)->member.next, typeof(*(pos)), member)
+
+#define	list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define	list_for_each_safe(pos, n, head)				\
+    for (pos = (head)->next, n = pos->next; pos != (head);		\
+	pos = n, n = pos->next)
+
+#define	list_for_each_entry(pos, head, member)				\
+    for (pos = list_first_entry(head, typeof(*pos), member);		\
+	&pos->member != (head);						\
+	pos = list_next_entry(pos, member))
+
+#define	list_for_each_entry_safe(pos, n, head, member)			\
+    for (pos = list_first_entry(head, typeof(*pos), member),		\
+	n = list_next_entry(pos, member);				\
+	&pos->member != (head);						\
+	pos = n, n = list_next_entry(n, member))
+
+
+/* ----- Hash list --------------------------------------------------------- */
+
+
+struct hlist_node {
+	struct hlist_node *next;
+	struct hlist_node **pprev;
+};
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+
+#define	HLIST_HEAD_INIT		{ NULL }
+#define	HLIST_HEAD(name)	struct hlist_head name = HLIST_HEAD_INIT
+
+
+static inline void INIT_HLIST_HEAD(struct hlist_head *h)
+{
+	h->first = NULL;
+}
+
+
+static inline void INIT_HLIST_NODE(struct hlist_node *n)
+{
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+
+static inline bool hlist_unhashed(const struct hlist_node *n)
+{
+	return !n->pprev;
+}
+
+
+static inline bool hlist_empty(const struct hlist_head *h)
+{
+	return !h->first;
+}
+
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	if (n->next)
+		n->next->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+
+#define	hlist_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define	hlist_entry_safe(ptr, type, member)				\
+    ({	typeof(ptr) hlist_entry_tmp = (ptr);				\
+	hlist_entry_tmp ?						\
+	    hlist_entry(hlist_entry_tmp, type, member) : NULL; })
+
+#define	hlist_for_each_entry(pos, head, member)				\
+    for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member);	\
+	pos;								\
+	pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
+
+#define	hlist_for_each_entry_safe(pos, n, head, member)			\
+    for (pos = hlist_entry_safe((head)->first, typeof(*pos), member);	\
+	pos && ({ n = pos->member.next; 1; });				\
+	pos = hlist_entry_safe(n, typeof(*pos), member))
+
+#endif /* !LINZHI_LIBCOMMON_LIST_H */
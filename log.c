@@ -0,0 +1,571 @@
+/*
+ * log.c - Asynchronous diagnostic logger
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Each thread that logs gets a ring buffer, with a single producer (the
+ * thread) and a single consumer (whoever holds drain_mutex). Records are
+ * contiguous: if a record does not fit before the end of the ring, a padding
+ * record skips to the beginning.
+ *
+ * A record holds the arguments captured with format_capture, followed by
+ * copies of the strings. If the format cannot be compiled, e.g., because it
+ * uses %n, the message is formatted right away, and the record holds the text
+ * instead.
+ *
+ * The drain thread sleeps on "wake_cond" when all rings are empty. Once woken
+ * up, it waits for BATCH_MS after each pass, so that a burst of messages costs
+ * only a few wake-ups.
+ *
+ * We use plain pthread mutexes, not lock() or wake_up(), since lock() logs
+ * when it stalls.
+ */
+
+#define	_GNU_SOURCE	/* for strnlen */
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+#include "dtime.h"
+#include "format.h"
+#include "list.h"
+#include "rate.h"
+#include "thread.h"
+#include "log.h"
+
+
+#define	RING_SIZE	(64 * 1024)	/* bytes, per thread; power of two */
+#define	RECORD_ALIGN	16		/* enough for long double */
+#define	BATCH_MS	10
+#define	OUT_BUF		4096		/* drain output, per write */
+#define	MSG_BUF		512		/* longer ones go on the heap */
+
+#define	RAW	((struct format *) &raw)
+
+
+struct record {
+	uint32_t		size;	/* including alignment */
+	uint32_t		suppressed;
+	const struct log_site	*site;	/* NULL if padding */
+	const struct format	*format; /* NULL if "args" holds the text */
+	int64_t			t;
+	union format_arg	args[];	/* followed by the strings */
+};
+
+struct ring {
+	char			*buf;
+	_Atomic size_t		head;	/* advanced by the producer */
+	_Atomic size_t		tail;	/* advanced by the consumer */
+	atomic_uint		dropped;
+	atomic_bool		dead;	/* the thread has exited */
+	struct list_head	list;
+};
+
+
+enum log_level log_threshold = log_level_debug;
+
+static char raw;	/* RAW points here */
+
+static __thread struct ring *my_ring = NULL;
+static pthread_key_t key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/* protects "rings" */
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(rings);
+
+/* serializes consumers, and protects "out" */
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char out[OUT_BUF];
+static size_t out_len = 0;
+
+/* "sleeping" is set by the drain thread, and cleared by whoever wakes it */
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool sleeping = 0;
+
+/* cleared in a child after fork, which then starts its own drain thread */
+static atomic_bool drain_started = 0;
+
+
+/* ----- Output ------------------------------------------------------------ */
+
+
+static void out_flush(void)
+{
+	fwrite(out, 1, out_len, stderr);
+	out_len = 0;
+}
+
+
+static void out_put(const char *s, size_t len)
+{
+	if (out_len + len > sizeof(out))
+		out_flush();
+	if (len > sizeof(out)) {
+		fwrite(s, 1, len, stderr);
+	} else {
+		memcpy(out + out_len, s, len);
+		out_len += len;
+	}
+}
+
+
+static void out_note(const char *what, unsigned n)
+{
+	char buf[64];
+
+	out_put(buf, snprintf(buf, sizeof(buf), "log: %u messages %s\n",
+	    n, what));
+}
+
+
+static void render(const struct record *rec)
+{
+	char tmp[MSG_BUF];
+	char *buf = tmp;
+	size_t len;
+
+	if (rec->suppressed)
+		out_note("suppressed", rec->suppressed);
+	if (!rec->format) {
+		buf = (char *) rec->args;
+		out_put(buf, strlen(buf));
+		return;
+	}
+	len = format_render_args(rec->format, tmp, sizeof(tmp), rec->args);
+	if (len >= sizeof(tmp)) {
+		buf = alloc_size(len + 1);
+		format_render_args(rec->format, buf, len + 1, rec->args);
+	}
+	out_put(buf, len);
+	if (buf != tmp)
+		free(buf);
+}
+
+
+/* ----- Consumer ---------------------------------------------------------- */
+
+
+static struct record *peek(struct ring *r)
+{
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	struct record *rec;
+
+	while (tail != head) {
+		rec = (struct record *) (r->buf + (tail & (RING_SIZE - 1)));
+		if (rec->site)
+			return rec;
+		tail += rec->size;
+		atomic_store_explicit(&r->tail, tail, memory_order_release);
+	}
+	return NULL;
+}
+
+
+static void consume(struct ring *r, const struct record *rec)
+{
+	atomic_fetch_add_explicit(&r->tail, rec->size, memory_order_release);
+}
+
+
+/*
+ * Write all pending records, oldest first, and return their number. The
+ * caller holds drain_mutex and rings_mutex.
+ */
+
+static unsigned drain_locked(void)
+{
+	struct ring *r, *next, *oldest_ring = NULL;
+	struct record *rec, *oldest;
+	unsigned n = 0, dropped;
+
+	list_for_each_entry(r, &rings, list) {
+		dropped = atomic_exchange_explicit(&r->dropped, 0,
+		    memory_order_relaxed);
+		if (dropped)
+			out_note("dropped", dropped);
+	}
+	while (1) {
+		oldest = NULL;
+		list_for_each_entry(r, &rings, list) {
+			rec = peek(r);
+			if (rec && (!oldest || rec->t < oldest->t)) {
+				oldest = rec;
+				oldest_ring = r;
+			}
+		}
+		if (!oldest)
+			break;
+		render(oldest);
+		consume(oldest_ring, oldest);
+		n++;
+	}
+	list_for_each_entry_safe(r, next, &rings, list)
+		if (atomic_load(&r->dead) && !peek(r)) {
+			list_del(&r->list);
+			free(r->buf);
+			free(r);
+		}
+	out_flush();
+	return n;
+}
+
+
+static unsigned drain(void)
+{
+	unsigned n;
+
+	pthread_mutex_lock(&drain_mutex);
+	pthread_mutex_lock(&rings_mutex);
+	n = drain_locked();
+	pthread_mutex_unlock(&rings_mutex);
+	pthread_mutex_unlock(&drain_mutex);
+	return n;
+}
+
+
+static void *drain_thread(void *arg)
+{
+	const struct timespec batch = {
+		.tv_sec		= 0,
+		.tv_nsec	= BATCH_MS * 1000000,
+	};
+
+	while (1) {
+		if (drain()) {
+			nanosleep(&batch, NULL);
+			continue;
+		}
+		atomic_store(&sleeping, 1);
+		/* pairs with the fence in commit */
+		atomic_thread_fence(memory_order_seq_cst);
+		if (drain()) {
+			atomic_store(&sleeping, 0);
+			continue;
+		}
+		pthread_mutex_lock(&wake_mutex);
+		while (atomic_load(&sleeping))
+			pthread_cond_wait(&wake_cond, &wake_mutex);
+		pthread_mutex_unlock(&wake_mutex);
+	}
+	return NULL;
+}
+
+
+void log_flush(void)
+{
+	drain();
+}
+
+
+/*
+ * Flush before fork, so that the child doesn't inherit pending messages. The
+ * child only resets the logger's state: the drain thread is started when the
+ * child first logs, and the rings of the threads that didn't survive the fork
+ * are freed by the next drain.
+ */
+
+static void before_fork(void)
+{
+	pthread_mutex_lock(&drain_mutex);
+	pthread_mutex_lock(&rings_mutex);
+	drain_locked();
+}
+
+
+static void after_fork_parent(void)
+{
+	pthread_mutex_unlock(&rings_mutex);
+	pthread_mutex_unlock(&drain_mutex);
+}
+
+
+static void after_fork_child(void)
+{
+	struct ring *r;
+
+	list_for_each_entry(r, &rings, list)
+		if (r != my_ring) {
+			atomic_store(&r->tail, atomic_load(&r->head));
+			atomic_store(&r->dead, 1);
+		}
+	after_fork_parent();
+	pthread_mutex_init(&wake_mutex, NULL);
+	pthread_cond_init(&wake_cond, NULL);
+	atomic_store(&sleeping, 0);
+	atomic_store(&drain_started, 0);
+}
+
+
+/* ----- Rings ------------------------------------------------------------- */
+
+
+static void ring_dead(void *user)
+{
+	struct ring *r = user;
+
+	my_ring = NULL;
+	atomic_store(&r->dead, 1);
+}
+
+
+static void init(void)
+{
+	int err;
+
+	err = pthread_key_create(&key, ring_dead);
+	if (err) {
+		fprintf(stderr, "pthread_key_create: %s\n", strerror(err));
+		exit(1);
+	}
+	atexit(log_flush);
+	pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+}
+
+
+/* thread_create may log, but then finds "drain_started" already set */
+
+static void start_drain(void)
+{
+	pthread_once(&once, init);
+	if (!atomic_exchange(&drain_started, 1))
+		thread_detach(thread_create(drain_thread, NULL, "log"));
+}
+
+
+static struct ring *get_ring(void)
+{
+	struct ring *r;
+
+	if (!atomic_load_explicit(&drain_started, memory_order_relaxed))
+		start_drain();
+	if (my_ring)
+		return my_ring;
+
+	r = alloc_type(struct ring);
+	r->buf = alloc_size(RING_SIZE);
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->dropped, 0);
+	atomic_init(&r->dead, 0);
+
+	pthread_mutex_lock(&rings_mutex);
+	list_add_tail(&r->list, &rings);
+	pthread_mutex_unlock(&rings_mutex);
+
+	pthread_setspecific(key, r);
+	my_ring = r;
+	return r;
+}
+
+
+/*
+ * Return space for a record of "size" bytes, or NULL if the ring is full.
+ * "head" is set to the position of the ring head after the record.
+ */
+
+static struct record *reserve(struct ring *r, size_t size, size_t *head)
+{
+	size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	size_t pos = h & (RING_SIZE - 1);
+	size_t skip = RING_SIZE - pos;
+	struct record *pad;
+
+	if (skip >= size)
+		skip = 0;
+	if (h + skip + size - tail > RING_SIZE) {
+		atomic_fetch_add_explicit(&r->dropped, 1,
+		    memory_order_relaxed);
+		return NULL;
+	}
+	if (skip) {
+		pad = (struct record *) (r->buf + pos);
+		pad->size = skip;
+		pad->site = NULL;
+		pos = 0;
+	}
+	*head = h + skip + size;
+	return (struct record *) (r->buf + pos);
+}
+
+
+static void commit(struct ring *r, size_t head)
+{
+	atomic_store_explicit(&r->head, head, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&sleeping, memory_order_relaxed) &&
+	    atomic_exchange(&sleeping, 0)) {
+		pthread_mutex_lock(&wake_mutex);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_mutex);
+	}
+}
+
+
+/* ----- Producer ---------------------------------------------------------- */
+
+
+static const struct format *site_format(struct log_site *site,
+    const char *fmt)
+{
+	struct format *f, *expected = NULL;
+
+	f = atomic_load_explicit(&site->format, memory_order_acquire);
+	if (f)
+		return f;
+	f = format_compile(fmt);
+	if (!f)
+		f = RAW;
+	if (atomic_compare_exchange_strong_explicit(&site->format, &expected,
+	    f, memory_order_acq_rel, memory_order_acquire))
+		return f;
+	/* another thread was faster */
+	if (f != RAW)
+		format_free(f);
+	return expected;
+}
+
+
+/*
+ * Return the total size of the strings in "args", with their NULs. If "dst"
+ * is not NULL, copy the strings there, and redirect "args" to the copies.
+ */
+
+static size_t strings(const struct format *f, union format_arg *args,
+    char *dst)
+{
+	const struct format_conv *c;
+	size_t total = 0;
+	size_t len;
+	int prec;
+
+	for (c = f->conv; c->conv; c++) {
+		prec = c->prec;
+		if (c->width == FORMAT_STAR)
+			args++;
+		if (c->prec == FORMAT_STAR)
+			prec = args++->i;
+		if (c->conv == 's' && args->s) {
+			len = prec < 0 ? strlen(args->s) :
+			    strnlen(args->s, prec);
+			if (dst) {
+				memcpy(dst + total, args->s, len);
+				dst[total + len] = 0;
+				args->s = dst + total;
+			}
+			total += len + 1;
+		}
+		args++;
+	}
+	return total;
+}
+
+
+static size_t record_size(size_t payload)
+{
+	size_t size = sizeof(struct record) + payload;
+
+	return (size + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1);
+}
+
+
+static bool put_args(struct ring *r, const struct log_site *site,
+    const struct format *f, int64_t t, unsigned suppressed, va_list ap)
+{
+	union format_arg args[f->n_args + 1];
+	size_t args_size = f->n_args * sizeof(union format_arg);
+	size_t str_size, size, head;
+	struct record *rec;
+
+	format_capture(f, args, ap);
+	str_size = strings(f, args, NULL);
+	size = record_size(args_size + str_size);
+	rec = reserve(r, size, &head);
+	if (!rec)
+		return 0;
+	rec->size = size;
+	rec->suppressed = suppressed;
+	rec->site = site;
+	rec->format = f;
+	rec->t = t;
+	strings(f, args, (char *) rec->args + args_size);
+	memcpy(rec->args, args, args_size);
+	commit(r, head);
+	return 1;
+}
+
+
+static bool put_text(struct ring *r, const struct log_site *site,
+    int64_t t, unsigned suppressed, const char *fmt, va_list ap)
+{
+	size_t len, size, head;
+	struct record *rec;
+	va_list aq;
+
+	va_copy(aq, ap);
+	len = vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	size = record_size(len + 1);
+	rec = reserve(r, size, &head);
+	if (!rec)
+		return 0;
+	rec->size = size;
+	rec->suppressed = suppressed;
+	rec->site = site;
+	rec->format = NULL;
+	rec->t = t;
+	vsnprintf((char *) rec->args, len + 1, fmt, ap);
+	commit(r, head);
+	return 1;
+}
+
+
+void log_site_printf(struct log_site *site, const char *fmt, ...)
+{
+	int64_t now = dtime_clock_ns();
+	unsigned suppressed = 0;
+	const struct format *f;
+	struct ring *r;
+	va_list ap;
+	bool ok;
+
+	if (site->limit) {
+		if (!rate_bucket_try_take(&site->bucket, 1, now)) {
+			atomic_fetch_add_explicit(&site->suppressed, 1,
+			    memory_order_relaxed);
+			return;
+		}
+		suppressed = atomic_exchange_explicit(&site->suppressed, 0,
+		    memory_order_relaxed);
+	}
+
+	r = get_ring();
+	f = site_format(site, fmt);
+	va_start(ap, fmt);
+	if (f == RAW)
+		ok = put_text(r, site, now, suppressed, fmt, ap);
+	else
+		ok = put_args(r, site, f, now, suppressed, ap);
+	va_end(ap);
+
+	/* report them with the next message instead */
+	if (!ok && suppressed)
+		atomic_fetch_add_explicit(&site->suppressed, suppressed,
+		    memory_order_relaxed);
+}
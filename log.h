@@ -0,0 +1,102 @@
+/*
+ * log.h - Asynchronous diagnostic logger
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Logging a message only copies the arguments of the format into a ring
+ * buffer owned by the calling thread. No lock is taken and nothing is
+ * formatted. A background thread merges the rings in time order, formats the
+ * messages, and writes them to stderr.
+ *
+ * Strings passed for %s are copied, so they only need to remain valid for the
+ * duration of the call. If a ring is full, the message is dropped, and the
+ * number of dropped messages is reported later.
+ *
+ * Messages are written as they are, without a prefix, and should therefore
+ * end with a newline. Pending messages are written at exit, or with
+ * log_flush.
+ */
+
+#ifndef LINZHI_LIBCOMMON_LOG_H
+#define	LINZHI_LIBCOMMON_LOG_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "rate.h"
+
+
+struct format;
+
+
+enum log_level {
+	log_level_error,
+	log_level_warn,
+	log_level_info,
+	log_level_debug,
+};
+
+/*
+ * Messages above LOG_LEVEL_MAX are removed at compile time. Messages above
+ * log_threshold (log_level_debug by default) are discarded at run time.
+ */
+
+#ifndef LOG_LEVEL_MAX
+#define	LOG_LEVEL_MAX	log_level_debug
+#endif
+
+/* one per call site, set up by the macros below */
+
+struct log_site {
+	struct format * _Atomic	format;		/* compiled on first use */
+	bool			limit;		/* rate-limited */
+	struct rate_bucket	bucket;
+	atomic_uint		suppressed;	/* by the rate limit */
+};
+
+
+extern enum log_level log_threshold;
+
+
+void log_site_printf(struct log_site *site, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* write all pending messages, and wait until they have been written */
+
+void log_flush(void);
+
+
+#define	log_site_call(level, limit_, bucket_, ...)			\
+    do {								\
+	static struct log_site log_site_tmp = {				\
+		.limit	= limit_,					\
+		.bucket	= bucket_,					\
+	};								\
+									\
+	if ((level) <= LOG_LEVEL_MAX && (level) <= log_threshold)	\
+		log_site_printf(&log_site_tmp, __VA_ARGS__);		\
+    } while (0)
+
+#define	log_printf(level, ...)						\
+	log_site_call(level, 0, { 0 }, __VA_ARGS__)
+
+/*
+ * Rate-limited variant: at most "burst" messages at once, then "rate"
+ * messages per second. The number of suppressed messages is reported with
+ * the next message that passes.
+ */
+
+#define	log_limit(level, rate, burst, ...)				\
+	log_site_call(level, 1, RATE_BUCKET_INIT(rate, burst), __VA_ARGS__)
+
+#define	log_error(...)	log_printf(log_level_error, __VA_ARGS__)
+#define	log_warn(...)	log_printf(log_level_warn, __VA_ARGS__)
+#define	log_info(...)	log_printf(log_level_info, __VA_ARGS__)
+#define	log_debug(...)	log_printf(log_level_debug, __VA_ARGS__)
+
+#endif /* !LINZHI_LIBCOMMON_LOG_H */
@@ -24,15 +24,23 @@
 #include "linzhi/alloc.h"
 
 #include "thread.h"
+#include "format.h"
+#include "list.h"
+#include "log.h"
+#include "topic.h"
 #include "mqtt.h"
 
 
+#define	FORMAT_BUF	256	/* shorter payloads stay on the stack */
+
+
 struct sub {
-	const char	*topic;
-	enum mqtt_qos	qos;
-	void		(*cb)(void *user, const char *topic, const char *msg);
-	void		*user;
-	struct sub	*next;
+	const struct topic	*topic;
+	enum mqtt_qos		qos;
+	void			(*cb)(void *user, const char *topic,
+				    const char *msg);
+	void			*user;
+	struct list_head	list;
 };
 
 
@@ -41,8 +49,9 @@ int mqtt_verbose = 0;
 static bool initialized = 0;
 static struct mosquitto *mosq;
 static struct mosquitto *mosq;
-static pthread_mutex_t mutex;	/* protects "subs" and "connected" */
-struct sub *subs = NULL;
+/* protects "subs" and "connected" */
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static LIST_HEAD(subs);
 static bool is_connected = 0;
 static bool is_threaded = 0;
 static bool shutting_down = 0;
@@ -61,7 +70,7 @@ static bool testing = 0;
 static void published(struct mosquitto *m, void *obj, int mid)
 {
 	if (mqtt_verbose > 2)
-		fprintf(stderr, "MQTT ACK\n");
+		log_debug("MQTT ACK\n");
 	pub_ack++;
 }
 
@@ -69,29 +78,48 @@ static void published(struct mosquitto *m, void *obj, int mid)
 /* ----- Transmission ------------------------------------------------------ */
 
 
-void mqtt_vprintf(const char *topic, enum mqtt_qos qos, bool retain,
-    const char *fmt, va_list ap)
+void mqtt_publish(const char *topic, enum mqtt_qos qos, bool retain,
+    const void *payload, size_t len)
 {
-	char *s;
 	int res;
 
 	assert(initialized);
-	if (vasprintf(&s, fmt, ap) < 0) {
-		perror("vasprintf");
-		exit(1);
-	}
 	if (mqtt_verbose > 1)
-		fprintf(stderr, "MQTT \"%s\" -> \"%s\"\n", topic, s);
+		log_debug("MQTT \"%s\" -> \"%.*s\"\n",
+		    topic, (int) len, (const char *) payload);
 	pub_enq++;
 	if (testing) {
-		printf("%s:%s\n", topic, s);
+		printf("%s:%.*s\n", topic, (int) len, (const char *) payload);
 	} else {
-		res = mosquitto_publish(mosq, NULL, topic, strlen(s), s,
+		res = mosquitto_publish(mosq, NULL, topic, len, payload,
 		    qos, retain);
 		if (res != MOSQ_ERR_SUCCESS)
-			fprintf(stderr, "warning: mosquitto_publish (%s): %s\n",
+			log_limit(log_level_warn, 1, 10,
+			    "warning: mosquitto_publish (%s): %s\n",
 			    topic, mosquitto_strerror(res));
 	}
+}
+
+
+void mqtt_publish_topic(const struct topic *topic, enum mqtt_qos qos,
+    bool retain, const void *payload, size_t len)
+{
+	mqtt_publish(topic->name, qos, retain, payload, len);
+}
+
+
+void mqtt_vprintf(const char *topic, enum mqtt_qos qos, bool retain,
+    const char *fmt, va_list ap)
+{
+	char *s;
+	int len;
+
+	len = vasprintf(&s, fmt, ap);
+	if (len < 0) {
+		perror("vasprintf");
+		exit(1);
+	}
+	mqtt_publish(topic, qos, retain, s, len);
 	free(s);
 }
 
@@ -108,6 +136,17 @@ void mqtt_printf(const char *topic, enum mqtt_qos qos, bool retain,
 }
 
 
+void mqtt_printf_topic(const struct topic *topic, enum mqtt_qos qos,
+    bool retain, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	mqtt_vprintf(topic->name, qos, retain, fmt, ap);
+	va_end(ap);
+}
+
+
 void mqtt_printf_arg(const char *topic, enum mqtt_qos qos, bool retain,
     const char *arg, const char *fmt, ...)
 {
@@ -126,6 +165,39 @@ void mqtt_printf_arg(const char *topic, enum mqtt_qos qos, bool retain,
 }
 
 
+void mqtt_vformat(const char *topic, enum mqtt_qos qos, bool retain,
+    const struct format *f, va_list ap)
+{
+	union format_arg args[f->n_args + 1];
+	char buf[FORMAT_BUF];
+	char *s;
+	size_t len;
+
+	format_capture(f, args, ap);
+	len = format_render_args(f, buf, sizeof(buf), args);
+	if (len < sizeof(buf)) {
+		mqtt_publish(topic, qos, retain, buf, len);
+		return;
+	}
+	s = alloc_size(len + 1);
+	format_render_args(f, s, len + 1, args);
+	mqtt_publish(topic, qos, retain, s, len);
+	free(s);
+}
+
+
+void mqtt_format(const char *topic, enum mqtt_qos qos, bool retain,
+    const struct format *f, ...)
+{
+	va_list ap;
+
+	assert(!strchr(topic, '%'));
+	va_start(ap, f);
+	mqtt_vformat(topic, qos, retain, f, ap);
+	va_end(ap);
+}
+
+
 /* ----- Last will --------------------------------------------------------- */
 
 
@@ -160,13 +232,17 @@ void mqtt_last_will(const char *topic, enum mqtt_qos qos, bool retain,
 
 void mqtt_deliver(const char *topic, const char *payload)
 {
+	const struct topic *t = topic_find(topic);
 	const struct sub *sub;
 
-	lock(&mutex);
-	for (sub = subs; sub; sub = sub->next)
-		if (!strcmp(sub->topic, topic))
+	/* nobody can have subscribed to a topic that was never interned */
+	if (!t)
+		return;
+	rdlock(&rwlock);
+	list_for_each_entry(sub, &subs, list)
+		if (sub->topic == t)
 			sub->cb(sub->user, topic, payload);
-	unlock(&mutex);
+	rwunlock(&rwlock);
 }
 
 
@@ -179,7 +255,7 @@ static void message(struct mosquitto *m, void *user,
 	if (shutting_down)
 		return;
 	if (mqtt_verbose > 1)
-		fprintf(stderr, "MQTT \"%s\": \"%.*s\"\n",
+		log_debug("MQTT \"%s\": \"%.*s\"\n",
 		    msg->topic, msg->payloadlen, (const char *) msg->payload);
 
 	buf = alloc_size(msg->payloadlen + 1);
@@ -221,17 +297,17 @@ void mqtt_subscribe(const char *topic, enum mqtt_qos qos,
 	va_end(ap);
 
 	sub = alloc_type(struct sub);
-	sub->topic = s;
+	sub->topic = topic_intern(s);
 	sub->qos = qos;
 	sub->cb = cb;
 	sub->user = user;
+	free(s);
 
-	lock(&mutex);
+	wrlock(&rwlock);
 	if (is_connected)
-		subscribe_one(topic, qos);
-	sub->next = subs;
-	subs = sub;
-	unlock(&mutex);
+		subscribe_one(sub->topic->name, qos);
+	list_add(&sub->list, &subs);
+	rwunlock(&rwlock);
 }
 
 
@@ -251,12 +327,12 @@ static void connected(struct mosquitto *m, void *data, int result)
 		exit(1);
 	}
 	if (mqtt_verbose)
-		fprintf(stderr, "MQTT connected\n");
-	lock(&mutex);
+		log_info("MQTT connected\n");
+	wrlock(&rwlock);
 	is_connected = 1;
-	for (sub = subs; sub; sub = sub->next)
-		subscribe_one(sub->topic, sub->qos);
-	unlock(&mutex);
+	list_for_each_entry(sub, &subs, list)
+		subscribe_one(sub->topic->name, sub->qos);
+	rwunlock(&rwlock);
 }
 
 
@@ -267,17 +343,16 @@ static void disconnected(struct mosquitto *m, void *data, int result)
 	assert(initialized);
 	if (shutting_down)
 		return;
-	lock(&mutex);	/* for synchronization */
+	wrlock(&rwlock);	/* for synchronization */
 	is_connected = 0;
-	unlock(&mutex);
+	rwunlock(&rwlock);
 
 	if (mqtt_verbose)
-		fprintf(stderr,
-		    "warning: reconnecting MQTT (disconnect reason %s)\n",
+		log_warn("warning: reconnecting MQTT (disconnect reason %s)\n",
 		    mosquitto_strerror(result));
 	res = mosquitto_reconnect(mosq);
 	if (res != MOSQ_ERR_SUCCESS)
-		fprintf(stderr, "mosquitto_reconnect: %s\n",
+		log_error("mosquitto_reconnect: %s\n",
 		    mosquitto_strerror(res));
 }
 
@@ -308,18 +383,21 @@ void mqtt_poll(short revents)
 	if (revents & POLLIN) {
 		res = mosquitto_loop_read(mosq, 1);
 		if (res != MOSQ_ERR_SUCCESS && mqtt_verbose)
-			fprintf(stderr, "warning: mosquitto_loop_read: %s\n",
+			log_limit(log_level_warn, 1, 10,
+			    "warning: mosquitto_loop_read: %s\n",
 			    mosquitto_strerror(res));
 	}
 	if (revents & POLLOUT) {
 		res = mosquitto_loop_write(mosq, 1);
 		if (res != MOSQ_ERR_SUCCESS && mqtt_verbose)
-			fprintf(stderr, "warning: mosquitto_loop_write: %s\n",
+			log_limit(log_level_warn, 1, 10,
+			    "warning: mosquitto_loop_write: %s\n",
 			    mosquitto_strerror(res));
 	}
 	res = mosquitto_loop_misc(mosq);
 	if (res != MOSQ_ERR_SUCCESS && mqtt_verbose)
-		fprintf(stderr, "warning: mosquitto_loop_misc: %s\n",
+		log_limit(log_level_warn, 1, 10,
+		    "warning: mosquitto_loop_misc: %s\n",
 		    mosquitto_strerror(res));
 }
 
@@ -380,17 +458,14 @@ void mqtt_init(const char *host, uint16_t port)
 	mosquitto_message_callback_set(mosq, message);
 	mosquitto_publish_callback_set(mosq, published);
 
-	pthread_mutex_init(&mutex, NULL);
-
 	if (will_topic) {
 		if (mqtt_verbose > 1)
-			fprintf(stderr, "WILL \"%s\" -> \"%s\"\n",
+			log_debug("WILL \"%s\" -> \"%s\"\n",
 			    will_topic, will_msg);
 		res = mosquitto_will_set(mosq, will_topic,
 		    strlen(will_msg), will_msg, will_qos, will_retain);
 		if (res != MOSQ_ERR_SUCCESS)
-			fprintf(stderr,
-			    "warning: mosquitto_set_will (%s): %s\n",
+			log_warn("warning: mosquitto_set_will (%s): %s\n",
 			    will_topic, mosquitto_strerror(res));
 	}
 
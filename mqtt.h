@@ -12,6 +12,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -19,6 +20,10 @@
 #define	MQTT_DEFAULT_PORT	1883
 
 
+struct format;
+struct topic;
+
+
 enum mqtt_qos {
 	qos_be		= 0,
 	qos_ack		= 1,
@@ -37,15 +42,44 @@ enum mqtt_qos {
 extern int mqtt_verbose;
 
 
+/*
+ * mqtt_publish sends "len" bytes of "payload" as is, e.g., the buffer of a
+ * struct sb.
+ */
+
+void mqtt_publish(const char *topic, enum mqtt_qos qos, bool retain,
+    const void *payload, size_t len);
+void mqtt_publish_topic(const struct topic *topic, enum mqtt_qos qos,
+    bool retain, const void *payload, size_t len);
 void mqtt_vprintf(const char *topic, enum mqtt_qos qos, bool retain,
     const char *fmt, va_list ap);
 void mqtt_printf(const char *topic, enum mqtt_qos qos, bool retain,
     const char *fmt, ...)
     __attribute__((format(printf, 4, 5)));
+void mqtt_printf_topic(const struct topic *topic, enum mqtt_qos qos,
+    bool retain, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/*
+ * mqtt_printf_arg formats the topic on each call. For repeated publishes, it
+ * is cheaper to bind a topic template (topic.h) once and use
+ * mqtt_printf_topic.
+ */
+
 void mqtt_printf_arg(const char *topic, enum mqtt_qos qos, bool retain,
     const char *arg, const char *fmt, ...)
     __attribute__((format(printf, 5, 6)));
 
+/*
+ * Like mqtt_printf, but with a format compiled with format_compile, which
+ * saves parsing the format on each call.
+ */
+
+void mqtt_vformat(const char *topic, enum mqtt_qos qos, bool retain,
+    const struct format *f, va_list ap);
+void mqtt_format(const char *topic, enum mqtt_qos qos, bool retain,
+    const struct format *f, ...);
+
 /*
  * mqtt_last_will must be called before (!) mqtt_init.
  * topic == NULL clears the last will message.
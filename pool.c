@@ -0,0 +1,287 @@
+/*
+ * pool.c - Pools of fixed-size objects
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+#include "thread.h"
+#include "pool.h"
+
+
+#define	CACHE_LINE	64
+#define	SLAB_SIZE	16384
+#define	MIN_PER_SLAB	8
+#define	BATCH		32	/* objects moved between cache and pool */
+
+
+struct pool_obj {
+	struct pool_obj		*next;
+};
+
+struct pool_slab {
+	struct pool_slab	*next;
+};
+
+struct pool_cache {
+	struct pool		*pool;
+	struct pool_obj		*free;
+	unsigned		n;
+	atomic_uint_least64_t	allocs;	/* only written by the owner */
+	atomic_uint_least64_t	frees;
+	struct pool_cache	*next;
+	struct pool_cache	**pprev;
+};
+
+
+/* ----- Shared free list -------------------------------------------------- */
+
+
+static size_t round_up(size_t n, size_t align)
+{
+	return (n + align - 1) / align * align;
+}
+
+
+/* called with pool->mutex held */
+
+static void add_slab(struct pool *pool)
+{
+	size_t hdr = round_up(sizeof(struct pool_slab),
+	    pool->flags & POOL_CACHELINE ? CACHE_LINE :
+	    _Alignof(max_align_t));
+	size_t size = round_up(hdr + pool->size * pool->per_slab, CACHE_LINE);
+	struct pool_slab *slab;
+	char *p;
+	unsigned i;
+
+	slab = aligned_alloc(CACHE_LINE, size);
+	if (!slab) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	pool->n_slabs++;
+
+	p = (char *) slab + hdr + pool->size * pool->per_slab;
+	for (i = 0; i != pool->per_slab; i++) {
+		struct pool_obj *obj;
+
+		p -= pool->size;
+		obj = (struct pool_obj *) p;
+		obj->next = pool->free;
+		pool->free = obj;
+	}
+}
+
+
+static void refill(struct pool *pool, struct pool_cache *c)
+{
+	struct pool_obj *obj;
+
+	lock(&pool->mutex);
+	while (c->n != BATCH) {
+		if (!pool->free)
+			add_slab(pool);
+		obj = pool->free;
+		pool->free = obj->next;
+		obj->next = c->free;
+		c->free = obj;
+		c->n++;
+	}
+	unlock(&pool->mutex);
+}
+
+
+/* called with pool->mutex held */
+
+static void drain(struct pool *pool, struct pool_cache *c, unsigned n)
+{
+	struct pool_obj *obj;
+
+	while (n--) {
+		obj = c->free;
+		c->free = obj->next;
+		obj->next = pool->free;
+		pool->free = obj;
+		c->n--;
+	}
+}
+
+
+/* ----- Per-thread caches ------------------------------------------------- */
+
+
+static void cache_destroy(void *arg)
+{
+	struct pool_cache *c = arg;
+	struct pool *pool = c->pool;
+
+	lock(&pool->mutex);
+	drain(pool, c, c->n);
+	pool->allocs += atomic_load_explicit(&c->allocs, memory_order_relaxed);
+	pool->frees += atomic_load_explicit(&c->frees, memory_order_relaxed);
+	*c->pprev = c->next;
+	if (c->next)
+		c->next->pprev = c->pprev;
+	unlock(&pool->mutex);
+	free(c);
+}
+
+
+static struct pool_cache *get_cache(struct pool *pool)
+{
+	struct pool_cache *c;
+	int err;
+
+	c = pthread_getspecific(pool->key);
+	if (c)
+		return c;
+
+	c = alloc_type(struct pool_cache);
+	c->pool = pool;
+	c->free = NULL;
+	c->n = 0;
+	atomic_init(&c->allocs, 0);
+	atomic_init(&c->frees, 0);
+
+	lock(&pool->mutex);
+	c->next = pool->caches;
+	if (c->next)
+		c->next->pprev = &c->next;
+	c->pprev = &pool->caches;
+	pool->caches = c;
+	unlock(&pool->mutex);
+
+	err = pthread_setspecific(pool->key, c);
+	if (err) {
+		fprintf(stderr, "pthread_setspecific: %s\n", strerror(err));
+		exit(1);
+	}
+	return c;
+}
+
+
+static void count(atomic_uint_least64_t *counter)
+{
+	atomic_store_explicit(counter,
+	    atomic_load_explicit(counter, memory_order_relaxed) + 1,
+	    memory_order_relaxed);
+}
+
+
+/* ----- Allocation -------------------------------------------------------- */
+
+
+void *pool_alloc(struct pool *pool)
+{
+	struct pool_cache *c = get_cache(pool);
+	struct pool_obj *obj;
+
+	if (!c->free)
+		refill(pool, c);
+	obj = c->free;
+	c->free = obj->next;
+	c->n--;
+	if (pool->flags & POOL_STATS)
+		count(&c->allocs);
+	return obj;
+}
+
+
+void pool_free(struct pool *pool, void *obj)
+{
+	struct pool_cache *c = get_cache(pool);
+	struct pool_obj *o = obj;
+
+	o->next = c->free;
+	c->free = o;
+	c->n++;
+	if (pool->flags & POOL_STATS)
+		count(&c->frees);
+	if (c->n >= 2 * BATCH) {
+		lock(&pool->mutex);
+		drain(pool, c, BATCH);
+		unlock(&pool->mutex);
+	}
+}
+
+
+void pool_stats(struct pool *pool, struct pool_stats *stats)
+{
+	const struct pool_cache *c;
+
+	lock(&pool->mutex);
+	stats->allocs = pool->allocs;
+	stats->frees = pool->frees;
+	for (c = pool->caches; c; c = c->next) {
+		stats->allocs += atomic_load_explicit(&c->allocs,
+		    memory_order_relaxed);
+		stats->frees += atomic_load_explicit(&c->frees,
+		    memory_order_relaxed);
+	}
+	stats->slabs = pool->n_slabs;
+	unlock(&pool->mutex);
+	stats->in_use = stats->allocs - stats->frees;
+	stats->bytes = (size_t) stats->slabs * pool->size * pool->per_slab;
+}
+
+
+/* ----- Setup and teardown ------------------------------------------------ */
+
+
+void pool_init(struct pool *pool, size_t size, unsigned flags)
+{
+	int err;
+
+	if (size < sizeof(struct pool_obj))
+		size = sizeof(struct pool_obj);
+	pool->size = round_up(size, flags & POOL_CACHELINE ? CACHE_LINE :
+	    _Alignof(max_align_t));
+	pool->per_slab = SLAB_SIZE / pool->size;
+	if (pool->per_slab < MIN_PER_SLAB)
+		pool->per_slab = MIN_PER_SLAB;
+	pool->flags = flags;
+	pthread_mutex_init(&pool->mutex, NULL);
+	err = pthread_key_create(&pool->key, cache_destroy);
+	if (err) {
+		fprintf(stderr, "pthread_key_create: %s\n", strerror(err));
+		exit(1);
+	}
+	pool->free = NULL;
+	pool->slabs = NULL;
+	pool->caches = NULL;
+	pool->n_slabs = 0;
+	pool->allocs = pool->frees = 0;
+}
+
+
+void pool_destroy(struct pool *pool)
+{
+	struct pool_slab *slab, *next_slab;
+	struct pool_cache *c, *next_cache;
+
+	pthread_key_delete(pool->key);
+	for (c = pool->caches; c; c = next_cache) {
+		next_cache = c->next;
+		free(c);
+	}
+	for (slab = pool->slabs; slab; slab = next_slab) {
+		next_slab = slab->next;
+		free(slab);
+	}
+	mutex_destroy(&pool->mutex);
+}
@@ -0,0 +1,77 @@
+/*
+ * pool.h - Pools of fixed-size objects
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Objects are carved from cache-line-aligned slabs that are never returned to
+ * the system before pool_destroy. Each thread keeps a small cache of free
+ * objects, so most allocations and frees take no lock. Objects may be freed by
+ * a different thread than the one that allocated them.
+ */
+
+#ifndef LINZHI_LIBCOMMON_POOL_H
+#define	LINZHI_LIBCOMMON_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+/* pool_init flags */
+
+#define	POOL_STATS	1	/* count allocations and frees */
+#define	POOL_CACHELINE	2	/* align objects to cache lines */
+
+
+struct pool_obj;
+struct pool_slab;
+struct pool_cache;
+
+struct pool {
+	size_t			size;	/* rounded object size */
+	unsigned		per_slab;
+	unsigned		flags;
+	pthread_mutex_t		mutex;	/* protects all of the below */
+	pthread_key_t		key;	/* per-thread cache */
+	struct pool_obj		*free;
+	struct pool_slab	*slabs;
+	struct pool_cache	*caches;
+	unsigned		n_slabs;
+	uint64_t		allocs;	/* of threads that have exited */
+	uint64_t		frees;
+};
+
+struct pool_stats {
+	uint64_t	allocs;
+	uint64_t	frees;
+	uint64_t	in_use;
+	unsigned	slabs;
+	size_t		bytes;	/* in slabs */
+};
+
+
+/* pool_destroy requires that no other thread still uses the pool */
+
+void pool_init(struct pool *pool, size_t size, unsigned flags);
+void pool_destroy(struct pool *pool);
+
+void *pool_alloc(struct pool *pool);
+void pool_free(struct pool *pool, void *obj);
+
+#define	pool_init_type(pool, t, flags) pool_init((pool), sizeof(t), (flags))
+#define	pool_alloc_type(pool, t)			\
+    ({	assert(sizeof(t) <= (pool)->size);		\
+	(t *) pool_alloc(pool); })
+
+/* allocs and frees are only counted with POOL_STATS */
+
+void pool_stats(struct pool *pool, struct pool_stats *stats);
+
+#endif /* !LINZHI_LIBCOMMON_POOL_H */
@@ -0,0 +1,187 @@
+/*
+ * rate.c - Rate estimators and rate limiters
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "alloc.h"
+#include "dtime.h"
+#include "rate.h"
+
+
+/* ----- EWMA -------------------------------------------------------------- */
+
+
+void rate_ewma_init(struct rate_ewma *m, unsigned n, const double *tau_s,
+    int64_t now)
+{
+	unsigned i;
+
+	assert(n && n <= RATE_EWMA_MAX);
+	atomic_init(&m->count, 0);
+	atomic_flag_clear(&m->busy);
+	m->last = now;
+	m->n = n;
+	for (i = 0; i != n; i++) {
+		m->tau_s[i] = tau_s[i];
+		atomic_init(&m->rate[i], 0);
+	}
+}
+
+
+void rate_ewma_add(struct rate_ewma *m, uint64_t events)
+{
+	atomic_fetch_add_explicit(&m->count, events, memory_order_relaxed);
+}
+
+
+void rate_ewma_update(struct rate_ewma *m, int64_t now)
+{
+	uint64_t count;
+	double dt, inst;
+	unsigned i;
+
+	/* if someone else is folding, their result is as good as ours */
+	if (atomic_flag_test_and_set_explicit(&m->busy, memory_order_acquire))
+		return;
+	dt = (now - m->last) * 1e-9;
+	if (dt > 0) {
+		count = atomic_exchange_explicit(&m->count, 0,
+		    memory_order_relaxed);
+		inst = count / dt;
+		for (i = 0; i != m->n; i++) {
+			double rate = atomic_load_explicit(&m->rate[i],
+			    memory_order_relaxed);
+
+			rate += -expm1(-dt / m->tau_s[i]) * (inst - rate);
+			atomic_store_explicit(&m->rate[i], rate,
+			    memory_order_relaxed);
+		}
+		m->last = now;
+	}
+	atomic_flag_clear_explicit(&m->busy, memory_order_release);
+}
+
+
+double rate_ewma_get(struct rate_ewma *m, unsigned i, int64_t now)
+{
+	assert(i < m->n);
+	rate_ewma_update(m, now);
+	return atomic_load_explicit(&m->rate[i], memory_order_relaxed);
+}
+
+
+/* ----- Sliding window ---------------------------------------------------- */
+
+
+/*
+ * Each bucket holds the low bits of its epoch (time / bucket_ns) in the upper
+ * bits and the event count in the lower bits, so that recycling a bucket for a
+ * new epoch and counting are a single compare-and-swap.
+ */
+
+#define	COUNT_BITS	40
+#define	COUNT_MASK	((1ull << COUNT_BITS) - 1)
+#define	TAG_MASK	((1ull << (64 - COUNT_BITS)) - 1)
+
+
+void rate_window_init(struct rate_window *w, double window_s,
+    unsigned buckets)
+{
+	unsigned i;
+
+	assert(buckets > 1 && buckets < TAG_MASK / 2);
+	w->n = buckets;
+	w->bucket_ns = window_s * 1e9 / buckets;
+	assert(w->bucket_ns > 0);
+	w->bucket = alloc_type_n(atomic_uint_least64_t, buckets);
+	for (i = 0; i != buckets; i++)
+		atomic_init(w->bucket + i, 0);
+}
+
+
+void rate_window_add(struct rate_window *w, uint64_t events, int64_t now)
+{
+	uint64_t epoch = now / w->bucket_ns;
+	uint64_t tag = epoch & TAG_MASK;
+	atomic_uint_least64_t *b = w->bucket + epoch % w->n;
+	uint64_t old, new;
+
+	old = atomic_load_explicit(b, memory_order_relaxed);
+	do {
+		if (old >> COUNT_BITS == tag)
+			new = old + events;
+		else
+			new = tag << COUNT_BITS | events;
+	} while (!atomic_compare_exchange_weak_explicit(b, &old, new,
+	    memory_order_relaxed, memory_order_relaxed));
+}
+
+
+uint64_t rate_window_sum(struct rate_window *w, int64_t now)
+{
+	uint64_t epoch = now / w->bucket_ns;
+	uint64_t sum = 0;
+	unsigned i;
+
+	for (i = 0; i != w->n; i++) {
+		uint64_t v = atomic_load_explicit(w->bucket + i,
+		    memory_order_relaxed);
+
+		if (((epoch - (v >> COUNT_BITS)) & TAG_MASK) < w->n)
+			sum += v & COUNT_MASK;
+	}
+	return sum;
+}
+
+
+double rate_window_rate(struct rate_window *w, int64_t now)
+{
+	/* the current bucket is only partially filled */
+	int64_t span = (w->n - 1) * w->bucket_ns + now % w->bucket_ns;
+
+	return rate_window_sum(w, now) / (span * 1e-9);
+}
+
+
+void rate_window_free(struct rate_window *w)
+{
+	free(w->bucket);
+}
+
+
+/* ----- Token bucket ------------------------------------------------------ */
+
+
+void rate_bucket_init(struct rate_bucket *b, double rate, double burst)
+{
+	assert(rate > 0 && burst >= 1);
+	atomic_init(&b->tat, 0);
+	b->interval = 1e9 / rate;
+	b->tolerance = burst * b->interval;
+}
+
+
+bool rate_bucket_try_take(struct rate_bucket *b, unsigned tokens,
+    int64_t now)
+{
+	int64_t tat = atomic_load_explicit(&b->tat, memory_order_relaxed);
+	int64_t new;
+
+	do {
+		new = (tat > now ? tat : now) + tokens * b->interval;
+		if (new - now > b->tolerance)
+			return 0;
+	} while (!atomic_compare_exchange_weak_explicit(&b->tat, &tat, new,
+	    memory_order_relaxed, memory_order_relaxed));
+	return 1;
+}
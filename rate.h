@@ -0,0 +1,92 @@
+/*
+ * rate.h - Rate estimators and rate limiters
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * All functions are lock-free and take the current time as "now", obtained
+ * with dtime_now_ns (see dtime.h), so that several of them can share one clock
+ * read.
+ */
+
+#ifndef LINZHI_LIBCOMMON_RATE_H
+#define	LINZHI_LIBCOMMON_RATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+
+#define	RATE_EWMA_MAX	4	/* maximum number of time constants */
+
+
+/*
+ * Exponentially weighted moving average of an event rate, with one average per
+ * time constant (e.g., 1, 5, and 15 minutes). Adding events only increments a
+ * counter. The counter is folded into the averages when they are read, or
+ * with rate_ewma_update.
+ */
+
+struct rate_ewma {
+	atomic_uint_least64_t	count;	/* events not yet folded in */
+	atomic_flag		busy;	/* folding in progress */
+	int64_t			last;	/* time of the last fold */
+	unsigned		n;
+	double			tau_s[RATE_EWMA_MAX];
+	_Atomic double		rate[RATE_EWMA_MAX];	/* events per second */
+};
+
+/*
+ * Count of events in a sliding window, divided into "buckets" intervals. The
+ * window advances in steps of one bucket.
+ */
+
+struct rate_window {
+	unsigned		n;
+	int64_t			bucket_ns;
+	atomic_uint_least64_t	*bucket;	/* epoch tag and count */
+};
+
+/*
+ * Token bucket that allows "burst" tokens at once and refills at "rate" tokens
+ * per second. Implemented as a generic cell rate algorithm, so that its state
+ * is a single atomic value.
+ */
+
+struct rate_bucket {
+	_Atomic int64_t		tat;		/* theoretical arrival time */
+	int64_t			interval;	/* ns per token */
+	int64_t			tolerance;	/* ns of burst */
+};
+
+/* static initializer, equivalent to rate_bucket_init */
+
+#define	RATE_BUCKET_INIT(rate, burst) {			\
+	.tat		= 0,				\
+	.interval	= 1e9 / (rate),			\
+	.tolerance	= (burst) * 1e9 / (rate),	\
+    }
+
+
+void rate_ewma_init(struct rate_ewma *m, unsigned n, const double *tau_s,
+    int64_t now);
+void rate_ewma_add(struct rate_ewma *m, uint64_t events);
+void rate_ewma_update(struct rate_ewma *m, int64_t now);
+double rate_ewma_get(struct rate_ewma *m, unsigned i, int64_t now);
+
+void rate_window_init(struct rate_window *w, double window_s,
+    unsigned buckets);
+void rate_window_add(struct rate_window *w, uint64_t events, int64_t now);
+uint64_t rate_window_sum(struct rate_window *w, int64_t now);
+double rate_window_rate(struct rate_window *w, int64_t now);
+void rate_window_free(struct rate_window *w);
+
+void rate_bucket_init(struct rate_bucket *b, double rate, double burst);
+bool rate_bucket_try_take(struct rate_bucket *b, unsigned tokens,
+    int64_t now);
+
+#endif /* !LINZHI_LIBCOMMON_RATE_H */
@@ -0,0 +1,326 @@
+/*
+ * rbtree.c - Intrusive red-black trees
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * The rebalancing follows Cormen et al., "Introduction to Algorithms", with
+ * NULL for the leaves instead of a sentinel. Since a leaf has no parent
+ * pointer, the erase fixup carries the parent of the current node along.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "rbtree.h"
+
+
+/* ----- Helpers ----------------------------------------------------------- */
+
+
+static bool is_red(const struct rb_node *node)
+{
+	return node && node->rb_red;
+}
+
+
+/* make "new" take the place of "old" below "parent" */
+
+static void change_child(struct rb_node *old, struct rb_node *new,
+    struct rb_node *parent, struct rb_root *root)
+{
+	if (!parent)
+		root->rb_node = new;
+	else if (parent->rb_left == old)
+		parent->rb_left = new;
+	else
+		parent->rb_right = new;
+}
+
+
+static void rotate_left(struct rb_node *x, struct rb_root *root)
+{
+	struct rb_node *y = x->rb_right;
+
+	x->rb_right = y->rb_left;
+	if (y->rb_left)
+		y->rb_left->rb_parent = x;
+	y->rb_parent = x->rb_parent;
+	change_child(x, y, x->rb_parent, root);
+	y->rb_left = x;
+	x->rb_parent = y;
+}
+
+
+static void rotate_right(struct rb_node *x, struct rb_root *root)
+{
+	struct rb_node *y = x->rb_left;
+
+	x->rb_left = y->rb_right;
+	if (y->rb_right)
+		y->rb_right->rb_parent = x;
+	y->rb_parent = x->rb_parent;
+	change_child(x, y, x->rb_parent, root);
+	y->rb_right = x;
+	x->rb_parent = y;
+}
+
+
+/* ----- Insertion --------------------------------------------------------- */
+
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *parent, *gparent, *uncle;
+
+	node->rb_red = 1;
+	while ((parent = node->rb_parent) && parent->rb_red) {
+		/* the root is black, so a red parent has a parent */
+		gparent = parent->rb_parent;
+		if (parent == gparent->rb_left) {
+			uncle = gparent->rb_right;
+			if (is_red(uncle)) {
+				parent->rb_red = uncle->rb_red = 0;
+				gparent->rb_red = 1;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->rb_right) {
+				rotate_left(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+			parent->rb_red = 0;
+			gparent->rb_red = 1;
+			rotate_right(gparent, root);
+		} else {
+			uncle = gparent->rb_left;
+			if (is_red(uncle)) {
+				parent->rb_red = uncle->rb_red = 0;
+				gparent->rb_red = 1;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->rb_left) {
+				rotate_right(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+			parent->rb_red = 0;
+			gparent->rb_red = 1;
+			rotate_left(gparent, root);
+		}
+	}
+	root->rb_node->rb_red = 0;
+}
+
+
+void rb_add(struct rb_node *node, struct rb_root *root,
+    bool (*less)(const struct rb_node *a, const struct rb_node *b))
+{
+	struct rb_node **link = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		if (less(node, parent))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(node, parent, link);
+	rb_insert_color(node, root);
+}
+
+
+/* ----- Removal ----------------------------------------------------------- */
+
+
+/* "node" is short one black; it may be NULL, hence "parent" */
+
+static void erase_fixup(struct rb_node *node, struct rb_node *parent,
+    struct rb_root *root)
+{
+	struct rb_node *sibling;
+
+	while (node != root->rb_node && !is_red(node)) {
+		/*
+		 * The sibling subtree has a black height of at least one, so
+		 * the sibling exists, and a NULL child of "parent" is "node".
+		 */
+		if (node == parent->rb_left) {
+			sibling = parent->rb_right;
+			if (sibling->rb_red) {
+				sibling->rb_red = 0;
+				parent->rb_red = 1;
+				rotate_left(parent, root);
+				sibling = parent->rb_right;
+			}
+			if (!is_red(sibling->rb_left) &&
+			    !is_red(sibling->rb_right)) {
+				sibling->rb_red = 1;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+			if (!is_red(sibling->rb_right)) {
+				sibling->rb_left->rb_red = 0;
+				sibling->rb_red = 1;
+				rotate_right(sibling, root);
+				sibling = parent->rb_right;
+			}
+			sibling->rb_red = parent->rb_red;
+			parent->rb_red = 0;
+			sibling->rb_right->rb_red = 0;
+			rotate_left(parent, root);
+		} else {
+			sibling = parent->rb_left;
+			if (sibling->rb_red) {
+				sibling->rb_red = 0;
+				parent->rb_red = 1;
+				rotate_right(parent, root);
+				sibling = parent->rb_left;
+			}
+			if (!is_red(sibling->rb_left) &&
+			    !is_red(sibling->rb_right)) {
+				sibling->rb_red = 1;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+			if (!is_red(sibling->rb_left)) {
+				sibling->rb_right->rb_red = 0;
+				sibling->rb_red = 1;
+				rotate_left(sibling, root);
+				sibling = parent->rb_left;
+			}
+			sibling->rb_red = parent->rb_red;
+			parent->rb_red = 0;
+			sibling->rb_left->rb_red = 0;
+			rotate_right(parent, root);
+		}
+		node = root->rb_node;
+		break;
+	}
+	if (node)
+		node->rb_red = 0;
+}
+
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *child, *parent, *next;
+	bool red;
+
+	if (!node->rb_left || !node->rb_right) {
+		child = node->rb_left ? node->rb_left : node->rb_right;
+		parent = node->rb_parent;
+		red = node->rb_red;
+		if (child)
+			child->rb_parent = parent;
+		change_child(node, child, parent, root);
+	} else {
+		/* the successor of "node" has no left child */
+		next = node->rb_right;
+		while (next->rb_left)
+			next = next->rb_left;
+		red = next->rb_red;
+		child = next->rb_right;
+		parent = next->rb_parent;
+		if (parent == node) {
+			parent = next;
+		} else {
+			if (child)
+				child->rb_parent = parent;
+			parent->rb_left = child;
+			next->rb_right = node->rb_right;
+			node->rb_right->rb_parent = next;
+		}
+		next->rb_left = node->rb_left;
+		node->rb_left->rb_parent = next;
+		next->rb_parent = node->rb_parent;
+		next->rb_red = node->rb_red;
+		change_child(node, next, node->rb_parent, root);
+	}
+	if (!red)
+		erase_fixup(child, parent, root);
+}
+
+
+/* ----- Lookup and traversal ---------------------------------------------- */
+
+
+struct rb_node *rb_find(const struct rb_root *root, const void *key,
+    int (*cmp)(const void *key, const struct rb_node *node))
+{
+	struct rb_node *node = root->rb_node;
+
+	while (node) {
+		int res = cmp(key, node);
+
+		if (!res)
+			return node;
+		node = res < 0 ? node->rb_left : node->rb_right;
+	}
+	return NULL;
+}
+
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_left)
+		node = node->rb_left;
+	return node;
+}
+
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_right)
+		node = node->rb_right;
+	return node;
+}
+
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+	const struct rb_node *parent;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return (struct rb_node *) node;
+	}
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+	return (struct rb_node *) parent;
+}
+
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+	const struct rb_node *parent;
+
+	if (node->rb_left) {
+		node = node->rb_left;
+		while (node->rb_right)
+			node = node->rb_right;
+		return (struct rb_node *) node;
+	}
+	while ((parent = node->rb_parent) && node == parent->rb_left)
+		node = parent;
+	return (struct rb_node *) parent;
+}
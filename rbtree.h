@@ -0,0 +1,101 @@
+/*
+ * rbtree.h - Intrusive red-black trees, in the style of the Linux kernel
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * struct rb_node is embedded in the elements. The tree does not know the keys,
+ * so the caller either walks the tree itself, finds the link to change, and
+ * then calls rb_link_node and rb_insert_color, as in the kernel:
+ *
+ * struct rb_node **link = &root->rb_node, *parent = NULL;
+ *
+ * while (*link) {
+ *	parent = *link;
+ *	if (key < rb_entry(parent, struct foo, node)->key)
+ *		link = &parent->rb_left;
+ *	else
+ *		link = &parent->rb_right;
+ * }
+ * rb_link_node(&new->node, parent, link);
+ * rb_insert_color(&new->node, root);
+ *
+ * or uses rb_add and rb_find with a comparison function.
+ */
+
+#ifndef LINZHI_LIBCOMMON_RBTREE_H
+#define	LINZHI_LIBCOMMON_RBTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "container.h"
+
+
+struct rb_node {
+	struct rb_node	*rb_parent;
+	struct rb_node	*rb_left;
+	struct rb_node	*rb_right;
+	bool		rb_red;
+};
+
+struct rb_root {
+	struct rb_node	*rb_node;
+};
+
+
+#define	RB_ROOT		((struct rb_root) { NULL })
+#define	RB_EMPTY_ROOT(root)	(!(root)->rb_node)
+
+#define	rb_entry(ptr, type, member)	container_of(ptr, type, member)
+
+#define	rb_entry_safe(ptr, type, member)				\
+    ({	typeof(ptr) rb_entry_tmp = (ptr);				\
+	rb_entry_tmp ? rb_entry(rb_entry_tmp, type, member) : NULL; })
+
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+    struct rb_node **link)
+{
+	node->rb_parent = parent;
+	node->rb_left = node->rb_right = NULL;
+	*link = node;
+}
+
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+
+/*
+ * "less" orders two nodes. Nodes that compare equal are added after the
+ * existing ones.
+ */
+
+void rb_add(struct rb_node *node, struct rb_root *root,
+    bool (*less)(const struct rb_node *a, const struct rb_node *b));
+
+/*
+ * "cmp" returns a negative value if "key" sorts before "node", zero if it
+ * matches, and a positive value otherwise. rb_find returns any matching node,
+ * or NULL.
+ */
+
+struct rb_node *rb_find(const struct rb_root *root, const void *key,
+    int (*cmp)(const void *key, const struct rb_node *node));
+
+
+#define	rbtree_for_each_entry(pos, root, member)			\
+    for (pos = rb_entry_safe(rb_first(root), typeof(*(pos)), member);	\
+	pos;								\
+	pos = rb_entry_safe(rb_next(&(pos)->member), typeof(*(pos)), member))
+
+#endif /* !LINZHI_LIBCOMMON_RBTREE_H */
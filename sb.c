@@ -0,0 +1,166 @@
+/*
+ * sb.c - Growable string builder
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "fmtnum.h"
+#include "sb.h"
+
+
+#define	MIN_SIZE	64
+
+
+void sb_init(struct sb *sb)
+{
+	sb->buf = NULL;
+	sb->len = sb->size = 0;
+}
+
+
+void sb_free(struct sb *sb)
+{
+	free(sb->buf);
+	sb_init(sb);
+}
+
+
+void sb_reset(struct sb *sb)
+{
+	sb->len = 0;
+	if (sb->buf)
+		*sb->buf = 0;
+}
+
+
+void sb_reserve(struct sb *sb, size_t n)
+{
+	size_t need = sb->len + n + 1;
+	size_t size;
+
+	if (need <= sb->size)
+		return;
+	size = sb->size < MIN_SIZE ? MIN_SIZE : sb->size;
+	while (size < need)
+		size *= 2;
+	sb->buf = realloc_size(sb->buf, size);
+	sb->size = size;
+}
+
+
+/* ----- Appending --------------------------------------------------------- */
+
+
+void sb_append_n(struct sb *sb, const char *s, size_t n)
+{
+	sb_reserve(sb, n);
+	memcpy(sb->buf + sb->len, s, n);
+	sb->len += n;
+	sb->buf[sb->len] = 0;
+}
+
+
+void sb_append(struct sb *sb, const char *s)
+{
+	sb_append_n(sb, s, strlen(s));
+}
+
+
+void sb_append_c(struct sb *sb, char c)
+{
+	sb_reserve(sb, 1);
+	sb->buf[sb->len++] = c;
+	sb->buf[sb->len] = 0;
+}
+
+
+void sb_append_u64(struct sb *sb, uint64_t v)
+{
+	sb_reserve(sb, FMTNUM_U64_MAX);
+	sb->len += fmtnum_u64(sb->buf + sb->len, v);
+}
+
+
+void sb_append_i64(struct sb *sb, int64_t v)
+{
+	sb_reserve(sb, FMTNUM_I64_MAX);
+	sb->len += fmtnum_i64(sb->buf + sb->len, v);
+}
+
+
+void sb_append_double(struct sb *sb, double v, int prec)
+{
+	size_t len;
+
+	sb_reserve(sb, FMTNUM_DOUBLE_MAX);
+	if (prec < 0) {
+		sb->len += fmtnum_double(sb->buf + sb->len, v);
+		return;
+	}
+	len = fmtnum_fixed(sb->buf + sb->len, sb->size - sb->len, v, prec);
+	if (sb->len + len >= sb->size) {
+		sb_reserve(sb, len);
+		fmtnum_fixed(sb->buf + sb->len, sb->size - sb->len, v, prec);
+	}
+	sb->len += len;
+}
+
+
+void sb_vprintf(struct sb *sb, const char *fmt, va_list ap)
+{
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	len = vsnprintf(sb->buf ? sb->buf + sb->len : NULL,
+	    sb->size - sb->len, fmt, aq);
+	va_end(aq);
+	if (len < 0) {
+		perror("vsnprintf");
+		exit(1);
+	}
+	if (sb->len + len >= sb->size) {
+		sb_reserve(sb, len);
+		vsnprintf(sb->buf + sb->len, sb->size - sb->len, fmt, ap);
+	}
+	sb->len += len;
+}
+
+
+void sb_printf(struct sb *sb, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	sb_vprintf(sb, fmt, ap);
+	va_end(ap);
+}
+
+
+/* ----- Retrieving -------------------------------------------------------- */
+
+
+const char *sb_str(const struct sb *sb)
+{
+	return sb->buf ? sb->buf : "";
+}
+
+
+char *sb_steal(struct sb *sb)
+{
+	char *s = sb->buf ? sb->buf : stralloc("");
+
+	sb_init(sb);
+	return s;
+}
@@ -0,0 +1,73 @@
+/*
+ * sb.h - Growable string builder
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Unlike stralloc_append, appending is amortized O(1): the builder tracks its
+ * length and grows its buffer geometrically. The buffer is always
+ * NUL-terminated once anything has been appended, so "buf" and "len" can be
+ * passed directly to mqtt_publish and the like.
+ *
+ * As in alloc.h, running out of memory is fatal.
+ */
+
+#ifndef LINZHI_LIBCOMMON_SB_H
+#define	LINZHI_LIBCOMMON_SB_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define	SB_INIT		{ NULL, 0, 0 }
+
+
+struct sb {
+	char	*buf;
+	size_t	len;	/* excluding the terminating NUL */
+	size_t	size;	/* allocated */
+};
+
+
+void sb_init(struct sb *sb);
+void sb_free(struct sb *sb);
+
+/* empty the builder, but keep the buffer */
+
+void sb_reset(struct sb *sb);
+
+/* make room for "n" more characters */
+
+void sb_reserve(struct sb *sb, size_t n);
+
+void sb_append(struct sb *sb, const char *s);
+void sb_append_n(struct sb *sb, const char *s, size_t n);
+void sb_append_c(struct sb *sb, char c);
+void sb_append_u64(struct sb *sb, uint64_t v);
+void sb_append_i64(struct sb *sb, int64_t v);
+
+/*
+ * With prec >= 0, append "v" with that many decimals, like %.*f. With
+ * prec < 0, append the shortest representation that reads back as "v".
+ */
+
+void sb_append_double(struct sb *sb, double v, int prec);
+
+void sb_vprintf(struct sb *sb, const char *fmt, va_list ap);
+void sb_printf(struct sb *sb, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* the string, also if nothing has been appended yet */
+
+const char *sb_str(const struct sb *sb);
+
+/* take over the buffer (to free it later), and leave the builder empty */
+
+char *sb_steal(struct sb *sb);
+
+#endif /* !LINZHI_LIBCOMMON_SB_H */
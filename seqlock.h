@@ -0,0 +1,134 @@
+/*
+ * seqlock.h - Sequence locks for small, frequently read structures
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Readers never write to the lock, so they don't bounce its cache line
+ * between CPUs. Instead, they retry if a writer was active while they were
+ * copying the data. Writers are serialized by the lock itself (they spin while
+ * another writer is active), so write sections must be short and must not
+ * block.
+ *
+ * Typical use:
+ *
+ * do {
+ *	seq = seqlock_read_begin(&sl);
+ *	copy = shared;
+ * } while (seqlock_read_retry(&sl, seq));
+ *
+ * or simply seqlock_read(&sl, &copy, &shared, sizeof(copy)), and likewise
+ * seqlock_write(&sl, &shared, &copy, sizeof(copy)).
+ *
+ * A struct seqlock contains no pointers and can therefore also be placed in
+ * memory shared between processes.
+ */
+
+#ifndef LINZHI_LIBCOMMON_SEQLOCK_H
+#define	LINZHI_LIBCOMMON_SEQLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+
+struct seqlock {
+	atomic_uint	seq;	/* odd while a writer is active */
+};
+
+
+#define	SEQLOCK_INIT	{ 0 }
+
+
+static inline void seqlock_init(struct seqlock *sl)
+{
+	atomic_init(&sl->seq, 0);
+}
+
+
+static inline unsigned seqlock_read_begin(const struct seqlock *sl)
+{
+	unsigned seq;
+
+	while (1) {
+		seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+		if (!(seq & 1))
+			return seq;
+		sched_yield();
+	}
+}
+
+
+/*
+ * Like seqlock_read_begin, but return 0 instead of waiting if a writer is
+ * active. For readers that must not wait for a writer that may have died.
+ */
+
+static inline bool seqlock_read_try_begin(const struct seqlock *sl,
+    unsigned *seq)
+{
+	*seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+	return !(*seq & 1);
+}
+
+
+static inline bool seqlock_read_retry(const struct seqlock *sl, unsigned seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&sl->seq, memory_order_relaxed) != seq;
+}
+
+
+static inline void seqlock_write_begin(struct seqlock *sl)
+{
+	unsigned seq = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+
+	while (1) {
+		if (!(seq & 1) && atomic_compare_exchange_weak_explicit(
+		    &sl->seq, &seq, seq + 1,
+		    memory_order_acquire, memory_order_relaxed))
+			break;
+		if (seq & 1) {
+			sched_yield();
+			seq = atomic_load_explicit(&sl->seq,
+			    memory_order_relaxed);
+		}
+	}
+	/* make the odd sequence number visible before any data update */
+	atomic_thread_fence(memory_order_release);
+}
+
+
+static inline void seqlock_write_end(struct seqlock *sl)
+{
+	atomic_fetch_add_explicit(&sl->seq, 1, memory_order_release);
+}
+
+
+static inline void seqlock_read(const struct seqlock *sl, void *dst,
+    const void *src, size_t size)
+{
+	unsigned seq;
+
+	do {
+		seq = seqlock_read_begin(sl);
+		memcpy(dst, src, size);
+	} while (seqlock_read_retry(sl, seq));
+}
+
+
+static inline void seqlock_write(struct seqlock *sl, void *dst,
+    const void *src, size_t size)
+{
+	seqlock_write_begin(sl);
+	memcpy(dst, src, size);
+	seqlock_write_end(sl);
+}
+
+#endif /* !LINZHI_LIBCOMMON_SEQLOCK_H */
@@ -0,0 +1,796 @@
+/*
+ * shm.c - Shared-memory telemetry for processes on the same host
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Layout of a channel:
+ *
+ * struct header, padded to HEADER_SIZE
+ * struct entry table[slots]	latest values, open addressing on the hash
+ * char ring[ring_size]		records, each contiguous
+ *
+ * Table entries are claimed by setting topic_len, and are never released.
+ * Their values are protected by a seqlock.
+ *
+ * The ring is read like a seqlock, too: the publisher advances "reserve"
+ * before overwriting old records, and "head" when the new record is complete.
+ * A reader copies a record, and then checks with "reserve" that it has not
+ * been overwritten in the meantime.
+ *
+ * Readers wait on a futex in the header, which works across processes. The
+ * publisher only makes the system call if there are waiting readers.
+ */
+
+#define	_GNU_SOURCE	/* for asprintf, vasprintf */
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "alloc.h"
+#include "dtime.h"
+#include "htable.h"
+#include "list.h"
+#include "log.h"
+#include "seqlock.h"
+#include "thread.h"
+#include "topic.h"
+#include "shm.h"
+
+
+#define	SHM_DIR		"/dev/shm/"
+#define	SHM_MAGIC	0x48535a4c	/* "LZSH" */
+#define	SHM_VERSION	1
+
+#define	HEADER_SIZE	64
+#define	RECORD_ALIGN	16	/* room for a padding record at the end */
+#define	MAX_RING	(1u << 30)
+#define	FORMAT_BUF	256	/* shorter payloads stay on the stack */
+#define	RECV_BUF	512	/* likewise, for received messages */
+#define	READ_TRIES	1000	/* then we assume the publisher died writing */
+#define	RETRY_MS	1000	/* look for a new channel after close */
+
+
+struct header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	slots;
+	uint32_t	ring_size;
+	atomic_uint	dead;		/* replaced or closed */
+	atomic_uint	wake;		/* futex, advanced by each publish */
+	atomic_uint	waiters;	/* readers in shm_wait */
+	atomic_uint	reserve;	/* end of the record being written */
+	atomic_uint	head;		/* end of the last complete record */
+};
+
+struct entry {
+	struct seqlock	seqlock;	/* protects len, stamp, and value */
+	atomic_uint	topic_len;	/* 0 if the slot is free */
+	uint32_t	len;		/* of the complete value */
+	uint32_t	pad;
+	uint64_t	hash;
+	int64_t		stamp;
+	char		topic[SHM_TOPIC_MAX];
+	char		value[SHM_VALUE_MAX];
+};
+
+struct record {
+	uint32_t	size;		/* including alignment */
+	uint32_t	topic_len;	/* 0 if padding */
+	uint32_t	len;
+	char		data[];		/* topic, NUL, value, NUL */
+};
+
+struct sub {
+	const struct topic	*topic;
+	void			(*cb)(void *user, const char *topic,
+				    const char *msg);
+	void			*user;
+	struct list_head	list;
+};
+
+struct shm {
+	char			*path;
+	bool			publisher;
+	void			*base;
+	size_t			size;
+	struct header		*hdr;
+	struct entry		*table;
+	char			*ring;
+
+	/* publisher: serializes claiming slots and writing the ring */
+	pthread_mutex_t		mutex;
+
+	/* reader */
+	uint32_t		tail;
+	bool			closed;	/* no new channel found yet */
+	int64_t			retry;	/* next time to look, in ns */
+	struct list_head	subs;
+};
+
+
+/* ----- Helpers ----------------------------------------------------------- */
+
+
+static uint32_t round_pow2(size_t n)
+{
+	uint32_t p = 1;
+
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+
+static size_t map_size(uint32_t slots, uint32_t ring_size)
+{
+	return HEADER_SIZE + (size_t) slots * sizeof(struct entry) + ring_size;
+}
+
+
+static char *shm_path(const char *name)
+{
+	char *s;
+
+	assert(!strchr(name, '/'));
+	if (asprintf(&s, SHM_DIR "%s", name) < 0) {
+		perror("asprintf");
+		exit(1);
+	}
+	return s;
+}
+
+
+static void *map(int fd, const char *path, size_t size)
+{
+	void *base;
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		perror(path);
+		exit(1);
+	}
+	return base;
+}
+
+
+static void setup(struct shm *shm, void *base, size_t size)
+{
+	shm->base = base;
+	shm->size = size;
+	shm->hdr = base;
+	shm->table = (struct entry *) ((char *) base + HEADER_SIZE);
+	shm->ring = (char *) (shm->table + shm->hdr->slots);
+}
+
+
+static void wake_readers(struct header *hdr)
+{
+	atomic_fetch_add(&hdr->wake, 1);
+	if (atomic_load(&hdr->waiters))
+		syscall(SYS_futex, &hdr->wake, FUTEX_WAKE, INT_MAX,
+		    NULL, NULL, 0);
+}
+
+
+/*
+ * Map the channel at "path". Returns NULL if it does not exist. If "strict" is
+ * set, an incompatible channel is a fatal error. Otherwise, we ignore it.
+ */
+
+static void *map_channel(const char *path, size_t *size, bool strict)
+{
+	const struct header *hdr;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return NULL;
+		perror(path);
+		exit(1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		exit(1);
+	}
+	if ((size_t) st.st_size < HEADER_SIZE) {
+		close(fd);
+		goto incompatible;
+	}
+	base = map(fd, path, st.st_size);
+	close(fd);
+
+	hdr = base;
+	if (hdr->magic == SHM_MAGIC && hdr->version == SHM_VERSION &&
+	    map_size(hdr->slots, hdr->ring_size) == (size_t) st.st_size) {
+		*size = st.st_size;
+		return base;
+	}
+	munmap(base, st.st_size);
+
+incompatible:
+	if (!strict)
+		return NULL;
+	fprintf(stderr, "%s: not a channel of version %u\n", path,
+	    SHM_VERSION);
+	exit(1);
+}
+
+
+/* ----- Publishing -------------------------------------------------------- */
+
+
+struct shm *shm_create(const char *name, unsigned slots, size_t ring_size)
+{
+	struct header *hdr;
+	struct shm *shm;
+	char *tmp;
+	void *old;
+	size_t size, old_size;
+	int fd;
+
+	_Static_assert(sizeof(struct header) <= HEADER_SIZE,
+	    "header too big");
+	assert(slots <= MAX_RING && ring_size <= MAX_RING);
+	slots = round_pow2(slots ? slots : SHM_DEFAULT_SLOTS);
+	ring_size = round_pow2(ring_size ? ring_size : SHM_DEFAULT_RING);
+	size = map_size(slots, ring_size);
+
+	shm = alloc_type(struct shm);
+	shm->path = shm_path(name);
+	shm->publisher = 1;
+	pthread_mutex_init(&shm->mutex, NULL);
+	INIT_LIST_HEAD(&shm->subs);
+
+	/* build the channel under a temporary name, then move it into place */
+	if (asprintf(&tmp, "%s.%u", shm->path, (unsigned) getpid()) < 0) {
+		perror("asprintf");
+		exit(1);
+	}
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(tmp);
+		exit(1);
+	}
+	if (ftruncate(fd, size) < 0) {
+		perror(tmp);
+		exit(1);
+	}
+	hdr = map(fd, tmp, size);
+	close(fd);
+
+	hdr->magic = SHM_MAGIC;
+	hdr->version = SHM_VERSION;
+	hdr->slots = slots;
+	hdr->ring_size = ring_size;
+	setup(shm, hdr, size);
+
+	old = map_channel(shm->path, &old_size, 0);
+	if (rename(tmp, shm->path) < 0) {
+		perror(shm->path);
+		exit(1);
+	}
+	free(tmp);
+
+	/* readers of the previous channel switch to the new one */
+	if (old) {
+		atomic_store(&((struct header *) old)->dead, 1);
+		wake_readers(old);
+		munmap(old, old_size);
+	}
+	return shm;
+}
+
+
+static struct entry *lookup(const struct shm *shm, uint64_t hash,
+    const char *topic, size_t len)
+{
+	uint32_t mask = shm->hdr->slots - 1;
+	struct entry *e;
+	uint32_t i, n;
+
+	for (i = 0; i != shm->hdr->slots; i++) {
+		e = shm->table + ((hash + i) & mask);
+		n = atomic_load_explicit(&e->topic_len, memory_order_acquire);
+		if (!n)
+			return NULL;
+		if (e->hash == hash && n == len &&
+		    !memcmp(e->topic, topic, len))
+			return e;
+	}
+	return NULL;
+}
+
+
+static struct entry *find_or_claim(struct shm *shm, uint64_t hash,
+    const char *topic, size_t len)
+{
+	uint32_t mask = shm->hdr->slots - 1;
+	struct entry *e;
+	uint32_t i, n;
+
+	e = lookup(shm, hash, topic, len);
+	if (e)
+		return e;
+	if (len >= SHM_TOPIC_MAX) {
+		log_limit(log_level_warn, 1, 10,
+		    "warning: shm: topic \"%s\" is too long\n", topic);
+		return NULL;
+	}
+
+	lock(&shm->mutex);
+	for (i = 0; i != shm->hdr->slots; i++) {
+		e = shm->table + ((hash + i) & mask);
+		n = atomic_load_explicit(&e->topic_len, memory_order_relaxed);
+		if (!n) {
+			e->hash = hash;
+			memcpy(e->topic, topic, len);
+			e->topic[len] = 0;
+			atomic_store_explicit(&e->topic_len, len,
+			    memory_order_release);
+			break;
+		}
+		if (e->hash == hash && n == len &&
+		    !memcmp(e->topic, topic, len))
+			break;
+	}
+	unlock(&shm->mutex);
+	if (i != shm->hdr->slots)
+		return e;
+	log_limit(log_level_warn, 1, 10,
+	    "warning: shm %s: table full, dropping \"%s\"\n",
+	    shm->path, topic);
+	return NULL;
+}
+
+
+static size_t record_size(size_t payload)
+{
+	size_t size = sizeof(struct record) + payload;
+
+	return (size + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1);
+}
+
+
+static void ring_put(struct shm *shm, const char *topic, size_t topic_len,
+    const void *payload, size_t len)
+{
+	struct header *hdr = shm->hdr;
+	size_t size = record_size(topic_len + len + 2);
+	uint32_t head, pos, skip;
+	struct record *rec;
+
+	if (size > hdr->ring_size / 2) {
+		log_limit(log_level_warn, 1, 10,
+		    "warning: shm: message on \"%s\" is too long\n", topic);
+		return;
+	}
+
+	lock(&shm->mutex);
+	head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+	pos = head & (hdr->ring_size - 1);
+	skip = hdr->ring_size - pos;
+	if (skip >= size)
+		skip = 0;
+	atomic_store_explicit(&hdr->reserve, head + skip + size,
+	    memory_order_relaxed);
+	/* make "reserve" visible before overwriting anything */
+	atomic_thread_fence(memory_order_release);
+	if (skip) {
+		rec = (struct record *) (shm->ring + pos);
+		rec->size = skip;
+		rec->topic_len = 0;
+		pos = 0;
+	}
+	rec = (struct record *) (shm->ring + pos);
+	rec->size = size;
+	rec->topic_len = topic_len;
+	rec->len = len;
+	memcpy(rec->data, topic, topic_len);
+	rec->data[topic_len] = 0;
+	memcpy(rec->data + topic_len + 1, payload, len);
+	rec->data[topic_len + 1 + len] = 0;
+	atomic_store_explicit(&hdr->head, head + skip + size,
+	    memory_order_release);
+	unlock(&shm->mutex);
+
+	wake_readers(hdr);
+}
+
+
+static void publish(struct shm *shm, uint64_t hash, const char *topic,
+    size_t topic_len, const void *payload, size_t len)
+{
+	struct entry *e;
+
+	assert(shm->publisher);
+	e = find_or_claim(shm, hash, topic, topic_len);
+	if (e) {
+		seqlock_write_begin(&e->seqlock);
+		e->len = len;
+		e->stamp = dtime_now_ns();
+		memcpy(e->value, payload,
+		    len < SHM_VALUE_MAX ? len : SHM_VALUE_MAX - 1);
+		seqlock_write_end(&e->seqlock);
+	}
+	ring_put(shm, topic, topic_len, payload, len);
+}
+
+
+void shm_publish(struct shm *shm, const char *topic, const void *payload,
+    size_t len)
+{
+	size_t topic_len = strlen(topic);
+
+	publish(shm, hash_mem(topic, topic_len), topic, topic_len,
+	    payload, len);
+}
+
+
+void shm_publish_topic(struct shm *shm, const struct topic *topic,
+    const void *payload, size_t len)
+{
+	publish(shm, topic->node.hash, topic->name, topic->len, payload, len);
+}
+
+
+void shm_vprintf(struct shm *shm, const char *topic, const char *fmt,
+    va_list ap)
+{
+	char buf[FORMAT_BUF];
+	char *s;
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	len = vsnprintf(buf, sizeof(buf), fmt, aq);
+	va_end(aq);
+	if (len < 0) {
+		perror("vsnprintf");
+		exit(1);
+	}
+	if ((size_t) len < sizeof(buf)) {
+		shm_publish(shm, topic, buf, len);
+		return;
+	}
+	if (vasprintf(&s, fmt, ap) < 0) {
+		perror("vasprintf");
+		exit(1);
+	}
+	shm_publish(shm, topic, s, len);
+	free(s);
+}
+
+
+void shm_printf(struct shm *shm, const char *topic, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	shm_vprintf(shm, topic, fmt, ap);
+	va_end(ap);
+}
+
+
+void shm_printf_topic(struct shm *shm, const struct topic *topic,
+    const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	shm_vprintf(shm, topic->name, fmt, ap);
+	va_end(ap);
+}
+
+
+/* ----- Reading ----------------------------------------------------------- */
+
+
+struct shm *shm_attach(const char *name)
+{
+	char *path = shm_path(name);
+	struct shm *shm;
+	size_t size;
+	void *base;
+
+	base = map_channel(path, &size, 1);
+	if (!base) {
+		free(path);
+		return NULL;
+	}
+	shm = alloc_type(struct shm);
+	shm->path = path;
+	shm->publisher = 0;
+	setup(shm, base, size);
+	shm->tail = atomic_load_explicit(&shm->hdr->head,
+	    memory_order_acquire);
+	shm->closed = 0;
+	shm->retry = 0;
+	INIT_LIST_HEAD(&shm->subs);
+	return shm;
+}
+
+
+/*
+ * If the publisher has replaced the channel, switch to the new one. Returns 0
+ * if the channel has been closed. In this case, we only look for a new channel
+ * every RETRY_MS.
+ */
+
+static bool reattach(struct shm *shm)
+{
+	int64_t now;
+	size_t size;
+	void *base;
+
+	if (shm->publisher ||
+	    !atomic_load_explicit(&shm->hdr->dead, memory_order_acquire))
+		return 1;
+	now = dtime_clock_ns();
+	if (shm->closed && now < shm->retry)
+		return 0;
+	shm->retry = now + RETRY_MS * 1000000LL;
+	base = map_channel(shm->path, &size, 1);
+	if (base) {
+		munmap(shm->base, shm->size);
+		setup(shm, base, size);
+		shm->tail = 0;
+	}
+	shm->closed = atomic_load_explicit(&shm->hdr->dead,
+	    memory_order_acquire);
+	return !shm->closed;
+}
+
+
+ssize_t shm_get(struct shm *shm, const char *topic, char *buf, size_t size,
+    int64_t *stamp)
+{
+	size_t topic_len = strlen(topic);
+	char value[SHM_VALUE_MAX];
+	const struct entry *e;
+	unsigned seq, tries = 0;
+	uint32_t len;
+	int64_t t;
+	size_t n;
+
+	if (!reattach(shm))
+		return -1;
+	e = lookup(shm, hash_mem(topic, topic_len), topic, topic_len);
+	if (!e)
+		return -1;
+	while (1) {
+		if (tries++ == READ_TRIES) {
+			log_limit(log_level_warn, 1, 10,
+			    "warning: shm %s: \"%s\" is stuck in a write\n",
+			    shm->path, topic);
+			return -1;
+		}
+		if (!seqlock_read_try_begin(&e->seqlock, &seq)) {
+			/* a new publisher won't finish this write */
+			if (atomic_load_explicit(&shm->hdr->dead,
+			    memory_order_relaxed))
+				return -1;
+			sched_yield();
+			continue;
+		}
+		len = e->len;
+		t = e->stamp;
+		n = len < SHM_VALUE_MAX ? len : SHM_VALUE_MAX - 1;
+		memcpy(value, e->value, n);
+		if (!seqlock_read_retry(&e->seqlock, seq))
+			break;
+	}
+	/* claimed, but not written yet */
+	if (!seq)
+		return -1;
+
+	if (size) {
+		if (n >= size)
+			n = size - 1;
+		memcpy(buf, value, n);
+		buf[n] = 0;
+	}
+	if (stamp)
+		*stamp = t;
+	return len;
+}
+
+
+void shm_subscribe(struct shm *shm, const char *topic,
+    void (*cb)(void *user, const char *topic, const char *msg), void *user,
+    ...)
+{
+	struct sub *sub;
+	va_list ap;
+	char *s;
+
+	va_start(ap, user);
+	if (vasprintf(&s, topic, ap) < 0) {
+		perror("vasprintf");
+		exit(1);
+	}
+	va_end(ap);
+
+	sub = alloc_type(struct sub);
+	sub->topic = topic_intern(s);
+	sub->cb = cb;
+	sub->user = user;
+	free(s);
+	list_add(&sub->list, &shm->subs);
+}
+
+
+static void deliver(const struct shm *shm, const char *topic,
+    const char *msg)
+{
+	const struct topic *t = topic_find(topic);
+	const struct sub *sub;
+
+	if (!t)
+		return;
+	list_for_each_entry(sub, &shm->subs, list)
+		if (sub->topic == t)
+			sub->cb(sub->user, topic, msg);
+}
+
+
+static bool record_ok(const struct record *rec, uint32_t pos,
+    uint32_t ring_size)
+{
+	if (rec->size < sizeof(struct record) || rec->size % RECORD_ALIGN ||
+	    rec->size > ring_size - pos)
+		return 0;
+	return !rec->topic_len ||
+	    (size_t) rec->topic_len + rec->len + 2 <=
+	    rec->size - sizeof(struct record);
+}
+
+
+unsigned shm_poll(struct shm *shm)
+{
+	const struct header *hdr;
+	struct record rec;
+	char tmp[RECV_BUF];
+	char *buf;
+	uint32_t head, pos, reserve;
+	unsigned n = 0;
+	size_t len = 0;
+	bool ok;
+
+	reattach(shm);
+	hdr = shm->hdr;
+	head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+	while (shm->tail != head) {
+		pos = shm->tail & (hdr->ring_size - 1);
+		memcpy(&rec, shm->ring + pos, sizeof(rec));
+		ok = record_ok(&rec, pos, hdr->ring_size);
+		buf = tmp;
+		if (ok && rec.topic_len) {
+			len = rec.topic_len + rec.len + 2;
+			if (len > sizeof(tmp))
+				buf = alloc_size(len);
+			memcpy(buf, shm->ring + pos + sizeof(rec), len);
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		reserve = atomic_load_explicit(&hdr->reserve,
+		    memory_order_relaxed);
+		if (reserve - shm->tail > hdr->ring_size) {
+			log_limit(log_level_warn, 1, 10,
+			    "warning: shm %s: reader overrun\n", shm->path);
+			shm->tail = head;
+		} else if (!ok) {
+			fprintf(stderr, "%s: corrupt record at %u\n",
+			    shm->path, (unsigned) pos);
+			exit(1);
+		} else {
+			shm->tail += rec.size;
+			if (rec.topic_len) {
+				deliver(shm, buf, buf + rec.topic_len + 1);
+				n++;
+			}
+		}
+		if (buf != tmp)
+			free(buf);
+	}
+	return n;
+}
+
+
+/* sleep until the publisher creates a new channel, or until the timeout */
+
+static bool wait_closed(struct shm *shm, int timeout_ms)
+{
+	int64_t end = dtime_clock_ns() + timeout_ms * 1000000LL;
+	struct timespec ts;
+	int64_t now, t;
+
+	while (1) {
+		now = dtime_clock_ns();
+		t = timeout_ms >= 0 && end < shm->retry ? end : shm->retry;
+		if (t > now) {
+			ts.tv_sec = (t - now) / DTIME_NS_PER_S;
+			ts.tv_nsec = (t - now) % DTIME_NS_PER_S;
+			nanosleep(&ts, NULL);
+		}
+		if (reattach(shm))
+			return 1;
+		if (timeout_ms >= 0 && dtime_clock_ns() >= end)
+			return 0;
+	}
+}
+
+
+bool shm_wait(struct shm *shm, int timeout_ms)
+{
+	struct header *hdr;
+	struct timespec ts;
+	unsigned wake;
+	bool ready;
+
+	if (!reattach(shm))
+		return wait_closed(shm, timeout_ms);
+	hdr = shm->hdr;
+	atomic_fetch_add(&hdr->waiters, 1);
+	wake = atomic_load(&hdr->wake);
+	ready = atomic_load_explicit(&hdr->head, memory_order_acquire) !=
+	    shm->tail || atomic_load(&hdr->dead);
+	if (!ready) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		ready = !syscall(SYS_futex, &hdr->wake, FUTEX_WAIT, wake,
+		    timeout_ms < 0 ? NULL : &ts, NULL, 0) ||
+		    errno != ETIMEDOUT;
+	}
+	atomic_fetch_sub(&hdr->waiters, 1);
+	return ready;
+}
+
+
+/* ----- Either ------------------------------------------------------------ */
+
+
+void shm_close(struct shm *shm)
+{
+	struct sub *sub, *next;
+
+	/* don't remove the channel of a new publisher */
+	if (shm->publisher && !atomic_exchange(&shm->hdr->dead, 1)) {
+		wake_readers(shm->hdr);
+		if (unlink(shm->path) < 0)
+			perror(shm->path);
+	}
+	if (shm->publisher)
+		mutex_destroy(&shm->mutex);
+	list_for_each_entry_safe(sub, next, &shm->subs, list) {
+		list_del(&sub->list);
+		free(sub);
+	}
+	munmap(shm->base, shm->size);
+	free(shm->path);
+	free(shm);
+}
@@ -0,0 +1,122 @@
+/*
+ * shm.h - Shared-memory telemetry for processes on the same host
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * A channel is a file in /dev/shm with one publishing process, which can have
+ * any number of readers. Each channel has
+ *
+ * - a table with the latest value of each topic, which readers can query at
+ *   any time with shm_get, and
+ * - a ring with the sequence of published messages, which readers receive
+ *   with shm_subscribe and shm_poll.
+ *
+ * Neither reading nor publishing makes system calls, except for waking up
+ * readers that wait in shm_wait.
+ *
+ * Topics are exact names, as in mqtt_deliver, of at most SHM_TOPIC_MAX - 1
+ * characters. Values longer than SHM_VALUE_MAX - 1 bytes are truncated in the
+ * table, but not in the ring. A reader that falls behind by more than the
+ * size of the ring loses the messages it missed.
+ *
+ * If the publisher restarts, readers switch to the new channel in shm_get,
+ * shm_poll, and shm_wait. Once the publisher has closed the channel, readers
+ * look for a new one about once per second. A reader handle must only be used
+ * by one thread at a time.
+ */
+
+#ifndef LINZHI_LIBCOMMON_SHM_H
+#define	LINZHI_LIBCOMMON_SHM_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+#define	SHM_TOPIC_MAX		96	/* including the NUL */
+#define	SHM_VALUE_MAX		128	/* in the table, including the NUL */
+
+#define	SHM_DEFAULT_SLOTS	1024		/* topics */
+#define	SHM_DEFAULT_RING	(256 * 1024)	/* bytes */
+
+
+struct shm;
+struct topic;
+
+
+/* ----- Publishing -------------------------------------------------------- */
+
+/*
+ * "name" is the name of the file in /dev/shm. "slots" (the maximum number of
+ * topics) and "ring_size" (in bytes) are rounded up to powers of two. Zero
+ * selects the default.
+ */
+
+struct shm *shm_create(const char *name, unsigned slots, size_t ring_size);
+
+void shm_publish(struct shm *shm, const char *topic, const void *payload,
+    size_t len);
+void shm_publish_topic(struct shm *shm, const struct topic *topic,
+    const void *payload, size_t len);
+void shm_vprintf(struct shm *shm, const char *topic, const char *fmt,
+    va_list ap);
+void shm_printf(struct shm *shm, const char *topic, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void shm_printf_topic(struct shm *shm, const struct topic *topic,
+    const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+
+/* ----- Reading ----------------------------------------------------------- */
+
+/* returns NULL if the channel does not exist (yet) */
+
+struct shm *shm_attach(const char *name);
+
+/*
+ * Copy the latest value of "topic" into "buf", like snprintf, and return its
+ * length, or -1 if nothing has been published on the topic. If "stamp" is not
+ * NULL, it is set to the dtime_now_ns of the publication.
+ *
+ * shm_get also returns -1 if the channel is closed, or if the value stays
+ * locked, e.g., because the publisher died while writing it.
+ */
+
+ssize_t shm_get(struct shm *shm, const char *topic, char *buf, size_t size,
+    int64_t *stamp);
+
+void shm_subscribe(struct shm *shm, const char *topic,
+    void (*cb)(void *user, const char *topic, const char *msg), void *user,
+    ...)
+    __attribute__((format(printf, 2, 5)));
+
+/*
+ * Deliver the messages published since the last call, and return their number.
+ * Only messages published after shm_attach are delivered.
+ */
+
+unsigned shm_poll(struct shm *shm);
+
+/*
+ * Wait until there may be new messages, or for at most "timeout_ms" (-1 to
+ * wait forever). Returns 0 on timeout. If the channel is closed, this waits
+ * for the publisher to create it again.
+ */
+
+bool shm_wait(struct shm *shm, int timeout_ms);
+
+
+/* ----- Either ------------------------------------------------------------ */
+
+/* the publisher removes the channel */
+
+void shm_close(struct shm *shm);
+
+#endif /* !LINZHI_LIBCOMMON_SHM_H */
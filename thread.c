@@ -7,18 +7,26 @@
  * A copy of the license can be found in the file COPYING.txt
  */
 
-#define	_GNU_SOURCE	/* for pthread_setname_np, vasprintf */
+#define	_GNU_SOURCE	/* for pthread_setname_np, vasprintf, CPU_SET */
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sched.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
 
 #include "alloc.h"
+#include "dtime.h"
+#include "list.h"
+#include "log.h"
 #include "thread.h"
 
 
@@ -37,9 +45,27 @@ static void get_time(struct timespec *t)
 }
 
 
+static void report_stall(const char *file, unsigned line)
+{
+	log_warn("%s:%u: waiting for lock > %u s\n",
+	    file, line, lock_timeout_s);
+}
+
+
+static void report_acquired(const struct timespec *timeout)
+{
+	struct timespec now;
+
+	get_time(&now);
+	log_info("lock successfully acquired after: %.3f s\n",
+	    (now.tv_sec - timeout->tv_sec + lock_timeout_s) +
+	    (double) (now.tv_nsec - timeout->tv_nsec) * 1e-9);
+}
+
+
 void lock_tracking(pthread_mutex_t *mutex, const char *file, unsigned line)
 {
-	struct timespec timeout, now;
+	struct timespec timeout;
 	int err;
 
 	get_time(&timeout);
@@ -51,17 +77,13 @@ void lock_tracking(pthread_mutex_t *mutex, const char *file, unsigned line)
 		fprintf(stderr, "pthread_mutex_timedlock: %s\n", strerror(err));
 		exit(1);
 	}
-	fprintf(stderr, "%s:%u: waiting for lock > %u s\n",
-	    file, line, lock_timeout_s);
+	report_stall(file, line);
 	err = pthread_mutex_lock(mutex);
 	if (err) {
 		fprintf(stderr, "pthread_mutex_lock: %s\n", strerror(err));
 		exit(1);
 	}
-	get_time(&now);
-	fprintf(stderr, "lock successfully acquired after: %.3f s\n",
-	    (now.tv_sec - timeout.tv_sec + lock_timeout_s) +
-	    (double) (now.tv_nsec - timeout.tv_nsec) * 1e-9);
+	report_acquired(&timeout);
 }
 
 
@@ -103,6 +125,85 @@ void mutex_destroy(pthread_mutex_t *mutex)
 }
 
 
+/* ----- Reader-writer locks ----------------------------------------------- */
+
+
+void rdlock_tracking(pthread_rwlock_t *rwlock, const char *file,
+    unsigned line)
+{
+	struct timespec timeout;
+	int err;
+
+	get_time(&timeout);
+	timeout.tv_sec += lock_timeout_s;
+	err = pthread_rwlock_timedrdlock(rwlock, &timeout);
+	if (!err)
+		return;
+	if (err != ETIMEDOUT) {
+		fprintf(stderr, "pthread_rwlock_timedrdlock: %s\n",
+		    strerror(err));
+		exit(1);
+	}
+	report_stall(file, line);
+	err = pthread_rwlock_rdlock(rwlock);
+	if (err) {
+		fprintf(stderr, "pthread_rwlock_rdlock: %s\n", strerror(err));
+		exit(1);
+	}
+	report_acquired(&timeout);
+}
+
+
+void wrlock_tracking(pthread_rwlock_t *rwlock, const char *file,
+    unsigned line)
+{
+	struct timespec timeout;
+	int err;
+
+	get_time(&timeout);
+	timeout.tv_sec += lock_timeout_s;
+	err = pthread_rwlock_timedwrlock(rwlock, &timeout);
+	if (!err)
+		return;
+	if (err != ETIMEDOUT) {
+		fprintf(stderr, "pthread_rwlock_timedwrlock: %s\n",
+		    strerror(err));
+		exit(1);
+	}
+	report_stall(file, line);
+	err = pthread_rwlock_wrlock(rwlock);
+	if (err) {
+		fprintf(stderr, "pthread_rwlock_wrlock: %s\n", strerror(err));
+		exit(1);
+	}
+	report_acquired(&timeout);
+}
+
+
+void rwunlock(pthread_rwlock_t *rwlock)
+{
+	int err;
+
+	err = pthread_rwlock_unlock(rwlock);
+	if (err) {
+		fprintf(stderr, "pthread_rwlock_unlock: %s\n", strerror(err));
+		exit(1);
+	}
+}
+
+
+void rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+	int err;
+
+	err = pthread_rwlock_destroy(rwlock);
+	if (err) {
+		fprintf(stderr, "pthread_rwlock_destroy: %s\n", strerror(err));
+		exit(1);
+	}
+}
+
+
 void wake_up(struct thread_wait *w)
 {
 	lock(&w->mutex);
@@ -151,9 +252,45 @@ struct thread_data {
 	void *(*fn)(void *arg);
 	void *arg;
 	char *name;
+	pthread_t thread;
+	pid_t tid;
+	struct timespec start;
+	struct list_head list;
 };
 
 
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(registry);
+static unsigned registry_n = 0;
+
+
+static void thread_register(struct thread_data *data)
+{
+	data->thread = pthread_self();
+	data->tid = syscall(SYS_gettid);
+	dtime_get(&data->start);
+
+	lock(&registry_mutex);
+	list_add(&data->list, &registry);
+	registry_n++;
+	unlock(&registry_mutex);
+}
+
+
+static void thread_unregister(void *arg)
+{
+	struct thread_data *data = arg;
+
+	lock(&registry_mutex);
+	list_del(&data->list);
+	registry_n--;
+	unlock(&registry_mutex);
+
+	free(data->name);
+	free(data);
+}
+
+
 static void *thread_wrapper(void *arg)
 {
 	struct thread_data *data = arg;
@@ -168,24 +305,85 @@ static void *thread_wrapper(void *arg)
 			    strerror(err));
 			exit(1);
 		}
-		free(data->name);
 	}
-	/* could copy then free, and use tail-call optimization */
+	thread_register(data);
+	/* unregister also if the thread is cancelled or calls pthread_exit */
+	pthread_cleanup_push(thread_unregister, data);
 	res = data->fn(data->arg);
-	free(data);
+	pthread_cleanup_pop(1);
 	return res;
 }
 
 
-pthread_t thread_create(void *(*fn)(void *arg), void *arg,
-    const char *name, ...)
+static void cpus_to_set(cpu_set_t *set, uint64_t cpus)
+{
+	unsigned i;
+
+	CPU_ZERO(set);
+	for (i = 0; i != 64; i++)
+		if (cpus >> i & 1)
+			CPU_SET(i, set);
+}
+
+
+static void apply_attr(pthread_attr_t *pa, const struct thread_attr *attr)
+{
+	int err;
+
+	if (attr->cpus) {
+		cpu_set_t set;
+
+		cpus_to_set(&set, attr->cpus);
+		err = pthread_attr_setaffinity_np(pa, sizeof(set), &set);
+		if (err) {
+			fprintf(stderr, "pthread_attr_setaffinity_np: %s\n",
+			    strerror(err));
+			exit(1);
+		}
+	}
+	if (attr->sched) {
+		struct sched_param param = {
+			.sched_priority = attr->priority,
+		};
+
+		err = pthread_attr_setinheritsched(pa, PTHREAD_EXPLICIT_SCHED);
+		if (!err)
+			err = pthread_attr_setschedpolicy(pa, attr->policy);
+		if (!err)
+			err = pthread_attr_setschedparam(pa, &param);
+		if (err) {
+			fprintf(stderr, "pthread_attr_setsched*: %s\n",
+			    strerror(err));
+			exit(1);
+		}
+	}
+	if (attr->stack_size) {
+		err = pthread_attr_setstacksize(pa, attr->stack_size);
+		if (err) {
+			fprintf(stderr, "pthread_attr_setstacksize (%zu): %s\n",
+			    attr->stack_size, strerror(err));
+			exit(1);
+		}
+	}
+	if (attr->guard_size) {
+		err = pthread_attr_setguardsize(pa, attr->guard_size);
+		if (err) {
+			fprintf(stderr, "pthread_attr_setguardsize (%zu): %s\n",
+			    attr->guard_size, strerror(err));
+			exit(1);
+		}
+	}
+}
+
+
+static pthread_t thread_vcreate(void *(*fn)(void *arg), void *arg,
+    const struct thread_attr *attr, const char *name, va_list ap)
 {
-	va_list ap;
 	struct thread_data *data;
+	pthread_attr_t pa;
 	pthread_t thread;
 	int err;
 
-	va_start(ap, name);
 	data = alloc_type(struct thread_data);
 	data->fn = fn;
 	data->arg = arg;
@@ -196,19 +394,54 @@ pthread_t thread_create(void *(*fn)(void *arg), void *arg,
 			exit(1);
 		}
 		if (strlen(data->name) > MAX_THREAD_NAME_LEN) {
-			fprintf(stderr, "warning: truncating \"%s\"\n",
-			    data->name);
+			log_warn("warning: truncating \"%s\"\n", data->name);
 			data->name[MAX_THREAD_NAME_LEN] = 0;
 		}
 	} else {
 		data->name = NULL;
 	}
 
-	err = pthread_create(&thread, NULL, thread_wrapper, data);
+	if (attr) {
+		err = pthread_attr_init(&pa);
+		if (err) {
+			fprintf(stderr, "pthread_attr_init: %s\n",
+			    strerror(err));
+			exit(1);
+		}
+		apply_attr(&pa, attr);
+	}
+	err = pthread_create(&thread, attr ? &pa : NULL, thread_wrapper, data);
 	if (err) {
 		fprintf(stderr, "pthread_create: %s\n", strerror(err));
 		exit(1);
 	}
+	if (attr)
+		pthread_attr_destroy(&pa);
+	return thread;
+}
+
+
+pthread_t thread_create(void *(*fn)(void *arg), void *arg,
+    const char *name, ...)
+{
+	va_list ap;
+	pthread_t thread;
+
+	va_start(ap, name);
+	thread = thread_vcreate(fn, arg, NULL, name, ap);
+	va_end(ap);
+	return thread;
+}
+
+
+pthread_t thread_create_attr(void *(*fn)(void *arg), void *arg,
+    const struct thread_attr *attr, const char *name, ...)
+{
+	va_list ap;
+	pthread_t thread;
+
+	va_start(ap, name);
+	thread = thread_vcreate(fn, arg, attr, name, ap);
 	va_end(ap);
 	return thread;
 }
@@ -250,3 +483,158 @@ void *thread_join(pthread_t thread)
 	}
 	return ret;
 }
+
+
+void thread_pin(uint64_t cpus)
+{
+	cpu_set_t set;
+	int err;
+
+	cpus_to_set(&set, cpus);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err) {
+		fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(err));
+		exit(1);
+	}
+}
+
+
+/* ----- Thread registry --------------------------------------------------- */
+
+
+static void read_csw(struct thread_stats *st)
+{
+	char path[64];
+	char line[100];
+	FILE *file;
+
+	st->vol_csw = st->invol_csw = 0;
+	sprintf(path, "/proc/self/task/%d/status", (int) st->tid);
+	file = fopen(path, "r");
+	if (!file)	/* the thread has exited in the meantime */
+		return;
+	while (fgets(line, sizeof(line), file))
+		if (sscanf(line, "voluntary_ctxt_switches: %lu",
+		    &st->vol_csw) != 1)
+			sscanf(line, "nonvoluntary_ctxt_switches: %lu",
+			    &st->invol_csw);
+	fclose(file);
+}
+
+
+static void get_stats(struct thread_stats *st, const struct thread_data *data)
+{
+	struct timespec t;
+	clockid_t clock;
+
+	st->thread = data->thread;
+	st->tid = data->tid;
+	if (data->name) {
+		strncpy(st->name, data->name, MAX_THREAD_NAME_LEN);
+		st->name[MAX_THREAD_NAME_LEN] = 0;
+	} else {
+		*st->name = 0;
+	}
+	st->start = data->start;
+	st->cpu_s = 0;
+	/* the thread is still alive, since it unregisters under our lock */
+	if (!pthread_getcpuclockid(data->thread, &clock) &&
+	    !clock_gettime(clock, &t))
+		st->cpu_s = t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+unsigned thread_stats(struct thread_stats *st, unsigned n)
+{
+	const struct thread_data *data;
+	unsigned i = 0, j, live;
+
+	lock(&registry_mutex);
+	list_for_each_entry(data, &registry, list) {
+		if (i == n)
+			break;
+		get_stats(st + i++, data);
+	}
+	live = registry_n;
+	unlock(&registry_mutex);
+
+	/* don't hold up thread_create and thread exit while reading /proc */
+	for (j = 0; j != i; j++)
+		read_csw(st + j);
+	return live;
+}
+
+
+static struct thread_stats *stats_alloc(unsigned *n)
+{
+	struct thread_stats *st = NULL;
+	unsigned size = 0;
+
+	while (1) {
+		*n = thread_stats(st, size);
+		if (*n <= size)
+			return st;
+		size = *n + 4;
+		st = realloc_type_n(st, size);
+	}
+}
+
+
+void thread_stats_dump(FILE *file)
+{
+	struct thread_stats *st;
+	struct timespec now;
+	unsigned n, i;
+
+	st = stats_alloc(&n);
+	dtime_get(&now);
+	fprintf(file, "%7s %-15s %10s %10s %10s %10s\n",
+	    "TID", "NAME", "AGE_S", "CPU_S", "VCSW", "IVCSW");
+	for (i = 0; i != n; i++)
+		fprintf(file, "%7d %-15s %10.3f %10.3f %10lu %10lu\n",
+		    (int) st[i].tid, st[i].name,
+		    (now.tv_sec - st[i].start.tv_sec) +
+		    (now.tv_nsec - st[i].start.tv_nsec) * 1e-9,
+		    st[i].cpu_s, st[i].vol_csw, st[i].invol_csw);
+	free(st);
+}
+
+
+struct monitor {
+	double interval_s;
+	void (*cb)(void *user, const struct thread_stats *st, unsigned n);
+	void *user;
+};
+
+
+static void *monitor_thread(void *arg)
+{
+	const struct monitor *mon = arg;
+	struct timespec t;
+	struct thread_stats *st;
+	unsigned n;
+
+	t.tv_sec = mon->interval_s;
+	t.tv_nsec = (mon->interval_s - t.tv_sec) * 1e9;
+	while (1) {
+		while (clock_nanosleep(CLOCK_BOOTTIME, 0, &t, NULL) == EINTR);
+		st = stats_alloc(&n);
+		mon->cb(mon->user, st, n);
+		free(st);
+	}
+	return NULL;
+}
+
+
+pthread_t thread_stats_monitor(double interval_s,
+    void (*cb)(void *user, const struct thread_stats *st, unsigned n),
+    void *user)
+{
+	struct monitor *mon;
+
+	mon = alloc_type(struct monitor);
+	mon->interval_s = interval_s;
+	mon->cb = cb;
+	mon->user = user;
+	return thread_create(monitor_thread, mon, "thread-monitor");
+}
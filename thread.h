@@ -11,12 +11,54 @@
 #define	LINZHI_LIBCOMMON_THREAD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/types.h>
 
 
 #define	DEFAULT_LOCK_TIMEOUT_S	600	/* 10 minutes */
 
 
+/*
+ * Thread creation attributes. A zero-initialized structure yields the same
+ * thread as thread_create. "cpus" is a bit mask of the CPUs the thread may run
+ * on (bit 0 is CPU 0), 0 to inherit the affinity of the creating thread. If
+ * "sched" is set, the thread uses "policy" (SCHED_OTHER, SCHED_FIFO, or
+ * SCHED_RR) at "priority", else it inherits both. "stack_size" and
+ * "guard_size" of 0 keep the defaults.
+ */
+
+struct thread_attr {
+	uint64_t	cpus;
+	bool		sched;
+	int		policy;
+	int		priority;
+	size_t		stack_size;
+	size_t		guard_size;
+};
+
+
+/*
+ * Snapshot of a thread started with thread_create or thread_create_attr.
+ * "start" is on the same (boot time) clock as dtime_get. "cpu_s" is the CPU
+ * time consumed so far. "vol_csw" counts voluntary context switches (the
+ * thread blocked), "invol_csw" involuntary ones (the thread was preempted).
+ */
+
+struct thread_stats {
+	pthread_t	thread;
+	pid_t		tid;
+	char		name[16];
+	struct timespec	start;
+	double		cpu_s;
+	unsigned long	vol_csw;
+	unsigned long	invol_csw;
+};
+
+
 struct thread_wait {
 	pthread_cond_t cond;
 	pthread_mutex_t mutex;
@@ -34,6 +76,16 @@ void mutex_destroy(pthread_mutex_t *mutex);
 
 #define	lock(mutex) lock_tracking(mutex, __FILE__, __LINE__)
 
+void rdlock_tracking(pthread_rwlock_t *rwlock, const char *file,
+    unsigned line);
+void wrlock_tracking(pthread_rwlock_t *rwlock, const char *file,
+    unsigned line);
+void rwunlock(pthread_rwlock_t *rwlock);
+void rwlock_destroy(pthread_rwlock_t *rwlock);
+
+#define	rdlock(rwlock) rdlock_tracking(rwlock, __FILE__, __LINE__)
+#define	wrlock(rwlock) wrlock_tracking(rwlock, __FILE__, __LINE__)
+
 void wake_up(struct thread_wait *w);
 
 void begin_wait(struct thread_wait *w);
@@ -43,8 +95,28 @@ void end_wait(struct thread_wait *w);
 pthread_t thread_create(void *(*fn)(void *arg), void *arg,
     const char *name, ...)
     __attribute__((format(printf, 3, 4)));
+pthread_t thread_create_attr(void *(*fn)(void *arg), void *arg,
+    const struct thread_attr *attr, const char *name, ...)
+    __attribute__((format(printf, 4, 5)));
 void thread_detach(pthread_t thread);
 void thread_cancel(pthread_t thread);
 void *thread_join(pthread_t thread);
 
+/* restrict the calling thread to the CPUs in the mask "cpus" */
+
+void thread_pin(uint64_t cpus);
+
+/*
+ * thread_stats fills up to "n" entries of "st" and returns the number of live
+ * threads, which may be larger than "n". thread_stats_monitor starts a thread
+ * that calls "cb" with a snapshot every "interval_s" seconds, e.g., to publish
+ * it.
+ */
+
+unsigned thread_stats(struct thread_stats *st, unsigned n);
+void thread_stats_dump(FILE *file);
+pthread_t thread_stats_monitor(double interval_s,
+    void (*cb)(void *user, const struct thread_stats *st, unsigned n),
+    void *user);
+
 #endif /* !LINZHI_LIBCOMMON_THREAD_H */
@@ -0,0 +1,499 @@
+/*
+ * timer.c - Timer wheel for periodic and deferred work
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Hierarchical timer wheel: level 0 has one slot per tick, each slot of level
+ * n covers 64^n ticks. Timers are moved ("cascaded") one level down when the
+ * wheel reaches the beginning of their slot. The scheduler thread sleeps on a
+ * CLOCK_BOOTTIME timerfd armed for the next tick at which anything happens, so
+ * an idle wheel costs no wakeups.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/timerfd.h>
+
+#include "alloc.h"
+#include "list.h"
+#include "thread.h"
+#include "dtime.h"
+#include "timer.h"
+
+
+#define	SLOT_BITS	6
+#define	SLOTS		(1 << SLOT_BITS)
+#define	SLOT_MASK	(SLOTS - 1)
+#define	LEVELS		4
+#define	MAX_DELTA	((1ull << (SLOT_BITS * LEVELS)) - 1)
+
+#define	NEVER		UINT64_MAX
+
+
+enum timer_where {
+	in_none		= 0,
+	in_wheel	= 1,
+	in_queue	= 2,
+};
+
+/* a callback in progress, on the stack of run_one */
+
+struct running {
+	const struct timer	*t;	/* may have been freed, if one-shot */
+	pthread_t		thread;
+	struct list_head	list;
+};
+
+struct timer_sched {
+	pthread_mutex_t	mutex;
+	struct timer	*slot[LEVELS][SLOTS];
+	uint64_t	bitmap[LEVELS];	/* occupied slots */
+	uint64_t	tick;		/* last tick processed */
+	uint64_t	armed;		/* tick the timerfd is set for */
+	int		fd;
+	bool		stopping;
+	pthread_t	thread;
+
+	/* expired timers, waiting for their callback to run */
+	struct timer	*queue;
+	struct timer	**queue_tail;
+	pthread_cond_t	queue_cond;
+	unsigned	n_workers;
+	pthread_t	*workers;
+
+	/* callbacks in progress, and timer_cancel_sync waiting for them */
+	struct list_head running;
+	pthread_cond_t	done_cond;
+	unsigned	sync_waiters;
+};
+
+
+static uint64_t now_tick(void)
+{
+	/* callbacks may refresh the cache of the scheduler thread */
+	return dtime_clock_ns() / TIMER_TICK_NS;
+}
+
+
+static uint64_t s_to_ticks(double s)
+{
+	return s <= 0 ? 0 : (uint64_t) (s * 1e9 + TIMER_TICK_NS - 1) /
+	    TIMER_TICK_NS;
+}
+
+
+/* ----- Lists ------------------------------------------------------------- */
+
+
+static void link_head(struct timer **head, struct timer *t)
+{
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+
+static void unlink_timer(struct timer_sched *s, struct timer *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	switch (t->where) {
+	case in_wheel:
+		if (!s->slot[t->level][t->slot])
+			s->bitmap[t->level] &= ~(1ull << t->slot);
+		break;
+	case in_queue:
+		if (s->queue_tail == &t->next)
+			s->queue_tail = t->pprev;
+		break;
+	default:
+		abort();
+	}
+	t->where = in_none;
+}
+
+
+static void enqueue(struct timer_sched *s, struct timer *t)
+{
+	t->next = NULL;
+	t->pprev = s->queue_tail;
+	*s->queue_tail = t;
+	s->queue_tail = &t->next;
+	t->where = in_queue;
+}
+
+
+/* ----- Wheel ------------------------------------------------------------- */
+
+
+/*
+ * Place a timer relative to s->tick. The caller ensures t->expires >= s->tick
+ * and that slot s->tick of level 0 has not been processed yet if they are
+ * equal.
+ */
+
+static void place(struct timer_sched *s, struct timer *t)
+{
+	uint64_t e = t->expires;
+	uint64_t delta = e - s->tick;
+	unsigned level;
+
+	if (delta > MAX_DELTA) {
+		e = s->tick + MAX_DELTA;
+		delta = MAX_DELTA;
+	}
+	for (level = 0; level != LEVELS - 1; level++)
+		if (delta < 1ull << (SLOT_BITS * (level + 1)))
+			break;
+	t->level = level;
+	t->slot = (e >> (SLOT_BITS * level)) & SLOT_MASK;
+	t->where = in_wheel;
+	link_head(&s->slot[level][t->slot], t);
+	s->bitmap[level] |= 1ull << t->slot;
+}
+
+
+static uint64_t rotr(uint64_t v, unsigned n)
+{
+	n &= 63;
+	return n ? v >> n | v << (64 - n) : v;
+}
+
+
+/* first tick after s->tick at which a slot expires or cascades */
+
+static uint64_t next_event(const struct timer_sched *s)
+{
+	uint64_t best = NEVER;
+	unsigned level;
+
+	for (level = 0; level != LEVELS; level++) {
+		unsigned shift = SLOT_BITS * level;
+		uint64_t base = s->tick >> shift;
+		uint64_t r, t;
+
+		r = rotr(s->bitmap[level], base + 1);
+		if (!r)
+			continue;
+		t = (base + __builtin_ctzll(r) + 1) << shift;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+
+static void cascade(struct timer_sched *s, unsigned level, unsigned slot)
+{
+	struct timer *t = s->slot[level][slot];
+	struct timer *next;
+
+	s->slot[level][slot] = NULL;
+	s->bitmap[level] &= ~(1ull << slot);
+	for (; t; t = next) {
+		next = t->next;
+		place(s, t);
+	}
+}
+
+
+static void advance(struct timer_sched *s, uint64_t target)
+{
+	while (s->tick < target) {
+		uint64_t next = next_event(s);
+		unsigned level, slot;
+		struct timer *t;
+
+		if (next > target) {
+			s->tick = target;
+			break;
+		}
+		s->tick = next;
+		for (level = 1; level != LEVELS; level++) {
+			unsigned shift = SLOT_BITS * level;
+
+			if (s->tick & ((1ull << shift) - 1))
+				break;
+			cascade(s, level, (s->tick >> shift) & SLOT_MASK);
+		}
+		slot = s->tick & SLOT_MASK;
+		while ((t = s->slot[0][slot])) {
+			unlink_timer(s, t);
+			enqueue(s, t);
+		}
+	}
+}
+
+
+static void arm(struct timer_sched *s, uint64_t tick)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (tick != NEVER) {
+		uint64_t ns = tick * TIMER_TICK_NS;
+
+		its.it_value.tv_sec = ns / 1000000000;
+		its.it_value.tv_nsec = ns % 1000000000;
+		if (!ns)
+			its.it_value.tv_nsec = 1;	/* zero would disarm */
+	}
+	if (timerfd_settime(s->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		perror("timerfd_settime");
+		exit(1);
+	}
+	s->armed = tick;
+}
+
+
+/* ----- Adding and cancelling --------------------------------------------- */
+
+
+static void add_locked(struct timer_sched *s, struct timer *t)
+{
+	uint64_t next;
+
+	if (t->expires <= s->tick)
+		t->expires = s->tick + 1;
+	place(s, t);
+	next = next_event(s);
+	if (next < s->armed)
+		arm(s, next);
+}
+
+
+void timer_init(struct timer *t, void (*fn)(struct timer *t, void *user),
+    void *user)
+{
+	memset(t, 0, sizeof(*t));
+	t->fn = fn;
+	t->user = user;
+}
+
+
+void timer_add(struct timer_sched *s, struct timer *t, double delay_s,
+    double period_s)
+{
+	uint64_t now = now_tick();
+
+	lock(&s->mutex);
+	if (t->where)
+		unlink_timer(s, t);
+	t->expires = now + s_to_ticks(delay_s);
+	t->period = s_to_ticks(period_s);
+	if (period_s > 0 && !t->period)
+		t->period = 1;
+	add_locked(s, t);
+	unlock(&s->mutex);
+}
+
+
+bool timer_cancel(struct timer_sched *s, struct timer *t)
+{
+	bool pending;
+
+	lock(&s->mutex);
+	pending = t->where;
+	if (pending)
+		unlink_timer(s, t);
+	t->period = 0;
+	unlock(&s->mutex);
+	return pending;
+}
+
+
+static bool is_running(const struct timer_sched *s, const struct timer *t)
+{
+	const struct running *r;
+
+	list_for_each_entry(r, &s->running, list)
+		if (r->t == t) {
+			/* we would wait for ourselves */
+			assert(!pthread_equal(r->thread, pthread_self()));
+			return 1;
+		}
+	return 0;
+}
+
+
+bool timer_cancel_sync(struct timer_sched *s, struct timer *t)
+{
+	bool pending = 0;
+
+	lock(&s->mutex);
+	t->period = 0;
+	while (1) {
+		/* the callback may have re-added the timer */
+		if (t->where) {
+			unlink_timer(s, t);
+			pending = 1;
+		}
+		if (!is_running(s, t))
+			break;
+		s->sync_waiters++;
+		pthread_cond_wait(&s->done_cond, &s->mutex);
+		s->sync_waiters--;
+	}
+	unlock(&s->mutex);
+	return pending;
+}
+
+
+/* ----- Running callbacks ------------------------------------------------- */
+
+
+static void rearm(struct timer_sched *s, struct timer *t)
+{
+	if (!t->period || t->where)
+		return;
+	t->expires += t->period;
+	if (t->expires <= s->tick)
+		t->expires += ((s->tick - t->expires) / t->period + 1) *
+		    t->period;
+	add_locked(s, t);
+}
+
+
+/* called and returns with s->mutex held */
+
+static void run_one(struct timer_sched *s)
+{
+	struct timer *t = s->queue;
+	bool periodic = t->period;
+	struct running r = {
+		.t	= t,
+		.thread	= pthread_self(),
+	};
+
+	unlink_timer(s, t);
+	list_add(&r.list, &s->running);
+	unlock(&s->mutex);
+	t->fn(t, t->user);
+	lock(&s->mutex);
+
+	/* one-shot timers may have been freed by their callback */
+	if (periodic)
+		rearm(s, t);
+	list_del(&r.list);
+	if (s->sync_waiters)
+		pthread_cond_broadcast(&s->done_cond);
+}
+
+
+static void *worker_thread(void *arg)
+{
+	struct timer_sched *s = arg;
+
+	lock(&s->mutex);
+	while (!s->stopping) {
+		if (s->queue)
+			run_one(s);
+		else
+			pthread_cond_wait(&s->queue_cond, &s->mutex);
+	}
+	unlock(&s->mutex);
+	return NULL;
+}
+
+
+static void *sched_thread(void *arg)
+{
+	struct timer_sched *s = arg;
+	uint64_t expirations;
+
+	while (1) {
+		if (read(s->fd, &expirations, sizeof(expirations)) < 0 &&
+		    errno != EINTR) {
+			perror("read timerfd");
+			exit(1);
+		}
+		lock(&s->mutex);
+		if (s->stopping)
+			break;
+		advance(s, now_tick());
+		arm(s, next_event(s));
+		if (s->n_workers) {
+			if (s->queue)
+				pthread_cond_broadcast(&s->queue_cond);
+		} else {
+			while (s->queue && !s->stopping)
+				run_one(s);
+		}
+		unlock(&s->mutex);
+	}
+	unlock(&s->mutex);
+	return NULL;
+}
+
+
+/* ----- Setup and teardown ------------------------------------------------ */
+
+
+struct timer_sched *timer_sched_new(unsigned workers)
+{
+	struct timer_sched *s;
+	unsigned i;
+
+	s = alloc_type(struct timer_sched);
+	memset(s, 0, sizeof(*s));
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->queue_cond, NULL);
+	pthread_cond_init(&s->done_cond, NULL);
+	INIT_LIST_HEAD(&s->running);
+	s->queue_tail = &s->queue;
+	s->tick = now_tick();
+	s->armed = NEVER;
+	s->fd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+	if (s->fd < 0) {
+		perror("timerfd_create");
+		exit(1);
+	}
+	s->thread = thread_create(sched_thread, s, "timer");
+	s->n_workers = workers;
+	if (workers) {
+		s->workers = alloc_type_n(pthread_t, workers);
+		for (i = 0; i != workers; i++)
+			s->workers[i] =
+			    thread_create(worker_thread, s, "timer-%u", i);
+	}
+	return s;
+}
+
+
+void timer_sched_destroy(struct timer_sched *s)
+{
+	unsigned i;
+
+	lock(&s->mutex);
+	s->stopping = 1;
+	arm(s, 0);	/* expire immediately */
+	pthread_cond_broadcast(&s->queue_cond);
+	unlock(&s->mutex);
+
+	thread_join(s->thread);
+	for (i = 0; i != s->n_workers; i++)
+		thread_join(s->workers[i]);
+	free(s->workers);
+	close(s->fd);
+	pthread_cond_destroy(&s->queue_cond);
+	pthread_cond_destroy(&s->done_cond);
+	mutex_destroy(&s->mutex);
+	free(s);
+}
@@ -0,0 +1,81 @@
+/*
+ * timer.h - Timer wheel for periodic and deferred work
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#ifndef LINZHI_LIBCOMMON_TIMER_H
+#define	LINZHI_LIBCOMMON_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define	TIMER_TICK_NS	1000000	/* 1 ms */
+
+
+/*
+ * Timers are embedded in the user's structures, so adding and cancelling never
+ * allocates. The scheduler accesses a timer while it is pending and while its
+ * callback runs. The fields are private to timer.c.
+ */
+
+struct timer {
+	void		(*fn)(struct timer *t, void *user);
+	void		*user;
+	uint64_t	expires;	/* tick */
+	uint64_t	period;		/* ticks, 0 for one-shot */
+	struct timer	*next;
+	struct timer	**pprev;
+	uint8_t		where;
+	uint8_t		level;
+	uint8_t		slot;
+};
+
+struct timer_sched;
+
+
+void timer_init(struct timer *t, void (*fn)(struct timer *t, void *user),
+    void *user);
+
+/*
+ * Schedule "t" to run after "delay_s" seconds and, if "period_s" is not zero,
+ * then every "period_s" seconds. Periods are measured from the scheduled (not
+ * the actual) start of the callback, so periodic timers do not drift. Adding
+ * a timer that is already pending reschedules it.
+ */
+
+void timer_add(struct timer_sched *s, struct timer *t, double delay_s,
+    double period_s);
+
+/*
+ * timer_cancel returns whether the timer was pending. It does not wait for a
+ * callback that is already running, but a cancelled periodic timer is not
+ * re-armed. Since the scheduler may still access the timer when the callback
+ * returns, the timer must not be freed after timer_cancel.
+ *
+ * timer_cancel_sync also waits until a running callback has returned and the
+ * scheduler is done with the timer, which can then be freed. It must not be
+ * called from the timer's callback, or while holding a lock the callback
+ * takes.
+ *
+ * One-shot timers may free themselves in their callback, periodic timers must
+ * not.
+ */
+
+bool timer_cancel(struct timer_sched *s, struct timer *t);
+bool timer_cancel_sync(struct timer_sched *s, struct timer *t);
+
+/*
+ * With "workers" set to 0, callbacks run on the scheduler thread and must
+ * therefore be short. Else, they are handed to a pool of that many threads.
+ * Pending timers are dropped by timer_sched_destroy.
+ */
+
+struct timer_sched *timer_sched_new(unsigned workers);
+void timer_sched_destroy(struct timer_sched *s);
+
+#endif /* !LINZHI_LIBCOMMON_TIMER_H */
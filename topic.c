@@ -0,0 +1,137 @@
+/*
+ * topic.c - Interned topic names
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "alloc.h"
+#include "container.h"
+#include "htable.h"
+#include "topic.h"
+
+
+#define	BIND_BUF	256	/* longer topics are built on the heap */
+
+
+struct key {
+	const char	*name;
+	size_t		len;
+};
+
+
+static struct htable_sharded topics;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+
+/* ----- Interning --------------------------------------------------------- */
+
+
+static bool topic_eq(const struct htable_node *node, const void *key)
+{
+	const struct topic *t = container_of(node, struct topic, node);
+	const struct key *k = key;
+
+	return t->len == k->len && !memcmp(t->name, k->name, k->len);
+}
+
+
+static struct htable_node *topic_new(void *user, const void *key)
+{
+	const struct key *k = key;
+	struct topic *t;
+
+	t = alloc_size(sizeof(struct topic) + k->len + 1);
+	t->len = k->len;
+	memcpy(t->name, k->name, k->len);
+	t->name[k->len] = 0;
+	return &t->node;
+}
+
+
+static void init(void)
+{
+	htable_sharded_init(&topics, topic_eq);
+}
+
+
+const struct topic *topic_intern_n(const char *name, size_t len)
+{
+	struct key key = {
+		.name	= name,
+		.len	= len,
+	};
+	struct htable_node *node;
+
+	pthread_once(&once, init);
+	node = htable_sharded_find_or_add(&topics, hash_mem(name, len), &key,
+	    topic_new, NULL);
+	return container_of(node, struct topic, node);
+}
+
+
+const struct topic *topic_intern(const char *name)
+{
+	return topic_intern_n(name, strlen(name));
+}
+
+
+const struct topic *topic_find(const char *name)
+{
+	struct key key = {
+		.name	= name,
+		.len	= strlen(name),
+	};
+	struct htable_node *node;
+
+	pthread_once(&once, init);
+	node = htable_sharded_find(&topics, hash_mem(name, key.len), &key);
+	return node ? container_of(node, struct topic, node) : NULL;
+}
+
+
+/* ----- Templates --------------------------------------------------------- */
+
+
+void topic_template_init(struct topic_template *tpl, const char *fmt)
+{
+	const char *s = strchr(fmt, '%');
+
+	if (!s || s[1] != 's' || strchr(s + 1, '%')) {
+		fprintf(stderr,
+		    "topic template \"%s\" needs exactly one %%s\n", fmt);
+		exit(1);
+	}
+	tpl->prefix = fmt;
+	tpl->prefix_len = s - fmt;
+	tpl->suffix = s + 2;
+	tpl->suffix_len = strlen(s + 2);
+}
+
+
+const struct topic *topic_bind(const struct topic_template *tpl,
+    const char *arg)
+{
+	size_t arg_len = strlen(arg);
+	size_t len = tpl->prefix_len + arg_len + tpl->suffix_len;
+	const struct topic *t;
+	char tmp[BIND_BUF];
+	char *buf = len <= sizeof(tmp) ? tmp : alloc_size(len);
+
+	memcpy(buf, tpl->prefix, tpl->prefix_len);
+	memcpy(buf + tpl->prefix_len, arg, arg_len);
+	memcpy(buf + tpl->prefix_len + arg_len, tpl->suffix, tpl->suffix_len);
+	t = topic_intern_n(buf, len);
+	if (buf != tmp)
+		free(buf);
+	return t;
+}
@@ -0,0 +1,57 @@
+/*
+ * topic.h - Interned topic names
+ *
+ * Copyright (C) 2023 Linzhi Ltd.
+ *
+ * This work is licensed under the terms of the MIT License.
+ * A copy of the license can be found in the file COPYING.txt
+ */
+
+/*
+ * Interning maps each topic name to a single struct topic, which is never
+ * freed. Two handles are therefore equal if and only if their names are, and
+ * the hash and the length of the name are computed only once.
+ *
+ * A template is a topic name with one %s, e.g., "/chip/%s/temp". Binding it
+ * to an argument yields the handle of the resulting topic, without going
+ * through printf.
+ */
+
+#ifndef LINZHI_LIBCOMMON_TOPIC_H
+#define	LINZHI_LIBCOMMON_TOPIC_H
+
+#include <stddef.h>
+
+#include "htable.h"
+
+
+struct topic {
+	struct htable_node	node;	/* node.hash is the hash of the name */
+	size_t			len;
+	char			name[];
+};
+
+/* the format string must remain valid while the template is in use */
+
+struct topic_template {
+	const char	*prefix;
+	size_t		prefix_len;
+	const char	*suffix;	/* after the %s */
+	size_t		suffix_len;
+};
+
+
+const struct topic *topic_intern(const char *name);
+const struct topic *topic_intern_n(const char *name, size_t len);
+
+/* returns NULL if the name has not been interned */
+
+const struct topic *topic_find(const char *name);
+
+/* "fmt" must contain exactly one %s, and no other % */
+
+void topic_template_init(struct topic_template *tpl, const char *fmt);
+const struct topic *topic_bind(const struct topic_template *tpl,
+    const char *arg);
+
+#endif /* !LINZHI_LIBCOMMON_TOPIC_H */